@@ -0,0 +1,41 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Every asset in one mapped file, looked up by the path it would have on disk (e.g. "data/wheel.obj.cache").
+// Loaders ask the pack first and fall back to loose files, so a missing or partial pack is never an error.
+// Each entry remembers the size and time of the source it was built from, init drops any entry whose source has since changed on
+// disk so edits to shaders, meshes and textures are picked up without rebuilding the pack, and lookups never touch the disk
+class Asset_Pack {
+public:
+	bool init(const char* filename);
+	void destroy();
+
+	bool is_open() const;
+
+	// Points straight into the mapping, valid until destroy, and safe to call from any thread once init has returned
+	bool find(const std::string& name, const char*& data, size_t& size) const;
+
+	// Packs the listed files as they are, paths are stored with forward slashes. sources[i] is the file files[i] was
+	// derived from, or files[i] itself, and is stamped so find can tell when the packed copy is stale
+	static bool build(const char* filename, const std::vector<std::string>& files, const std::vector<std::string>& sources);
+
+	// Appends every file under directory whose name ends in extension
+	static void list_files(const char* directory, const char* extension, std::vector<std::string>& files);
+
+private:
+	struct Entry {
+		const char* data;
+		size_t size;
+	};
+
+	Mapped_File file;
+	std::unordered_map<std::string, Entry> entries;
+};
+
+extern Asset_Pack asset_pack;
@@ -11,6 +11,10 @@ using namespace utils;
 struct Camera {
 	Camera();
 	void update(std::map<int, Transform>& transforms);
+	void update_frustum();
+
+	bool sphere_visible(const vec3& centre, float radius) const;
+	bool aabb_visible(const vec3& min, const vec3& max) const;
 
 	bool follow_vehicle;
 	bool target_changed;
@@ -34,10 +38,17 @@ struct Camera {
 	vec3 old_target;
 	
 	mat4 matrix_view;
+	mat4 matrix_view_projection;
 	mat4 matrix_projection_persp;
 	mat4 matrix_projection_ortho;
 
+	// Left, right, bottom, top, near, far as (normal, distance), normals point inwards
+	vec4 frustum_planes[6];
+
 	float height;
 	int index_list_position_current;
 	std::vector<vec3> list_position_current;
+
+	// Fraction of the way from the current orbit point to the next, lets a scripted path glide between them
+	float path_blend;
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Byte stream for checkpoints, values are copied bit for bit so a restore reproduces them exactly
+struct Checkpoint_Writer {
+	std::vector<uint8_t> bytes;
+
+	template <typename T>
+	void write(const T& v) {
+		size_t offset = bytes.size();
+		bytes.resize(offset + sizeof(T));
+		memcpy(&bytes[offset], &v, sizeof(T));
+	}
+
+	void write_string(const std::string& s) {
+		write(static_cast<uint32_t>(s.size()));
+		bytes.insert(bytes.end(), s.begin(), s.end());
+	}
+};
+
+// Reads back what Checkpoint_Writer wrote, ok is cleared instead of reading past the end
+struct Checkpoint_Reader {
+	Checkpoint_Reader(const uint8_t* data, size_t size) : p(data), end(data + size), ok(true) { }
+
+	template <typename T>
+	void read(T& v) {
+		if (static_cast<size_t>(end - p) < sizeof(T)) {
+			ok = false;
+			memset(&v, 0, sizeof(T));
+			return;
+		}
+
+		memcpy(&v, p, sizeof(T));
+		p += sizeof(T);
+	}
+
+	template <typename T>
+	T read() {
+		T v;
+		read(v);
+		return v;
+	}
+
+	std::string read_string() {
+		uint32_t size = read<uint32_t>();
+		if (static_cast<size_t>(end - p) < size) {
+			ok = false;
+			return std::string();
+		}
+
+		std::string s(reinterpret_cast<const char*>(p), size);
+		p += size;
+		return s;
+	}
+
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok;
+};
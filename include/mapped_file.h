@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// Read-only view of a whole file, the OS pages it in on demand instead of copying it through a stream
+class Mapped_File {
+public:
+	Mapped_File();
+	~Mapped_File();
+
+	Mapped_File(const Mapped_File&) = delete;
+	Mapped_File& operator = (const Mapped_File&) = delete;
+
+	// Moving hands over the view and its handles, so classes holding one stay movable
+	Mapped_File(Mapped_File&& other);
+	Mapped_File& operator = (Mapped_File&& other);
+
+	bool init(const char* filename);
+	void destroy();
+
+	const char* data;
+	size_t size;
+
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+};
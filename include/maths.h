@@ -1,7 +1,25 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+#include <new>
 #include <ostream>
 #include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHS_SSE
+#include <xmmintrin.h>
+#endif
+
+#if defined(MATHS_SSE) && defined(__AVX__)
+#define MATHS_AVX
+#include <immintrin.h>
+#endif
 																													   
 namespace maths {
 	extern float PI;
@@ -136,7 +154,9 @@ namespace maths {
 		};
 	};
 
-	class mat4 {
+	// Rows are 16 byte aligned so each fills one SSE register. The heap only honours that with C++17 aligned new, so arrays of
+	// matrices live in an Aligned_Vector. mult and model_matrix take matrices from anywhere and still load unaligned
+	class alignas(16) mat4 {
 	public:
 		mat4() : n{{1, 0, 0, 0},{0, 1, 0, 0},{0, 0, 1, 0},{0, 0, 0, 1}} {}
 		mat4(const vec4& a, const vec4& b, const vec4& c, const vec4& d) : n{a, b, c, d} {}
@@ -165,6 +185,44 @@ namespace maths {
 		};
 	};
 
+	// Allocates on alignof(T), so vectors of mat4 or of structs holding one can be stored to with aligned SIMD stores
+	template <typename T>
+	class Aligned_Allocator {
+	public:
+		typedef T value_type;
+
+		Aligned_Allocator() {}
+		template <typename U> Aligned_Allocator(const Aligned_Allocator<U>&) {}
+
+		T* allocate(size_t n) {
+			const size_t alignment = (alignof(T) > sizeof(void*)) ? alignof(T) : sizeof(void*);
+#ifdef _WIN32
+			void* p = _aligned_malloc(n * sizeof(T), alignment);
+#else
+			void* p = nullptr;
+			if (posix_memalign(&p, alignment, n * sizeof(T)) != 0)
+				p = nullptr;
+#endif
+			if (p == nullptr)
+				throw std::bad_alloc();
+			return static_cast<T*>(p);
+		}
+
+		void deallocate(T* p, size_t) {
+#ifdef _WIN32
+			_aligned_free(p);
+#else
+			free(p);
+#endif
+		}
+
+		template <typename U> friend bool operator == (const Aligned_Allocator&, const Aligned_Allocator<U>&) { return true; }
+		template <typename U> friend bool operator != (const Aligned_Allocator&, const Aligned_Allocator<U>&) { return false; }
+	};
+
+	template <typename T>
+	using Aligned_Vector = std::vector<T, Aligned_Allocator<T>>;
+
 	bool almost_equal(float x, float y, float error_factor);
 	bool almost_equal(const vec2& a, const vec2& b, float error_factor);
 
@@ -196,6 +254,16 @@ namespace maths {
 
 	float min(float x, float y);
 
+	// Fused scale * rotate(rotation) * transpose(translate(position)), without building the intermediate matrices
+	mat4 model_matrix(const vec3& size, const vec3& position, const vec3& rotation);
+
+	// Batched model_matrix over transforms split into one array per component, x, y and z of each. Builds four matrices per
+	// iteration with SSE or eight with AVX, out has to be 16 byte aligned as Aligned_Vector storage is
+	void model_matrices(const float* const sizes[3], const float* const positions[3], const float* const rotations[3], size_t count, mat4* out);
+
+	// Inverse transpose of the upper 3x3 of m, for transforming normals under non-uniform scale
+	mat4 normal_matrix(const mat4& m);
+
 	vec4 mult(const mat4& m, const vec4& v);
 	mat4 mult(const mat4& a, const mat4& b);
 
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Counters the simulation thread updates with relaxed atomics, so the metrics listener can read them at any time without a lock
+struct Metrics {
+	enum Phase { PHASE_PHYSICS, PHASE_SENSORS, PHASE_RESPAWN, PHASE_OUTPUT, PHASE_COUNT };
+
+	// Upper bounds of the tick time histogram in seconds, the last bucket is everything above
+	static const int TICK_BUCKETS = 9;
+	static const double TICK_BUCKET_BOUNDS[TICK_BUCKETS - 1];
+
+	Metrics();
+
+	void record_phase(Phase phase, std::chrono::steady_clock::duration time);
+	void record_tick(std::chrono::steady_clock::duration time);
+
+	// Prometheus text exposition of every counter
+	std::string exposition() const;
+
+	std::atomic<uint64_t> ticks;
+	std::atomic<uint64_t> tick_buckets[TICK_BUCKETS];
+	std::atomic<uint64_t> tick_nanoseconds;
+	std::atomic<uint64_t> phase_nanoseconds[PHASE_COUNT];
+	std::atomic<float> tick_rate;
+
+	std::atomic<int> predators;
+	std::atomic<int> prey;
+	std::atomic<uint64_t> respawns;
+	std::atomic<uint64_t> catches;
+	std::atomic<int> contacts;
+
+private:
+	// Only touched by the simulation thread
+	std::chrono::steady_clock::time_point rate_window_start;
+	uint64_t rate_window_ticks;
+};
+
+// Serves GET /metrics on 127.0.0.1 from its own thread, a slow or stuck client never reaches the simulation thread
+class Metrics_Server {
+public:
+	Metrics_Server();
+
+	bool init(int port, const Metrics* metrics);
+	void destroy();
+
+private:
+	std::thread listener;
+	std::atomic<bool> stopping;
+};
@@ -1,29 +1,51 @@
 #pragma once
 
+#include "asset_pack.h"
+#include "mapped_file.h"
 #include "maths.h"
 #include "shader.h"
 #include "texture.h"
 #include "utils.h"
 
+#include <cstdint>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace maths;
 using namespace utils;
 
+// Interleaved vertex as uploaded, normals packed 10:10:10:2 and uvs as two halfs, meshes without uvs stop after the normal
+struct Packed_Vertex {
+	vec3 position;
+	uint32_t normal;
+	uint16_t uv[2];
+};
+
+// Round-to-nearest-even float to IEEE half, overflow becomes infinity and NaNs stay NaNs
+uint16_t pack_half(float f);
+
+// CPU-side arrays only live until upload, draws go through the index buffer with index_count.
+// vertex_source and index_source point at what upload will send, either the packed arrays or the mapped cache
 struct Mesh {
 	std::vector<vec3> vertices;
 	std::vector<vec3> normals;
 	std::vector<vec2> uvs;
+	std::vector<uint32_t> indices;
+	std::vector<char> packed_vertices;
 	bool uvs_included;
 
-	std::vector<int> vertex_indices, normal_indices, uv_indices;
+	const char* vertex_source;
+	const uint32_t* index_source;
+	size_t vertex_count;
+
+	GLsizei index_count;
+	GLsizei vertex_stride;
 
 	GLuint vao;
-	GLuint vbo_vertices;
-	GLuint vbo_normals;
-	GLuint vbo_uvs;
+	GLuint vbo;
+	GLuint ebo;
 };
 
 struct Model {
@@ -31,11 +53,27 @@ struct Model {
 	void init(const char* filename);
 	void destroy();
 
+	// init split in two, load touches no GL state so it can run on a worker thread, upload must run on the context thread
+	bool load(const char* filename);
+	void upload();
+
 	std::vector<Mesh> meshes;
 
 private:
-	void load_meshes(const char* filename, const std::vector<std::pair<int, int>>& data_ranges);
-	void process_face(std::string& line, bool uvs_included, std::vector<int>& vertex_indices, std::vector<int>& uv_indices, std::vector<int>& normal_indices);
-	bool check_uvs_included(const char* filename);
-	std::vector<std::pair<int, int>> file_preprocess(const char* filename);
+	void load_meshes(const char* filename);
+	bool process_face(const char* s, const char* end, const std::vector<vec3>& vertex_list, const std::vector<vec3>& normal_list, const std::vector<vec2>& uv_list);
+	void optimise_mesh(Mesh& mesh);
+	void pack_mesh(Mesh& mesh);
+
+	// Binary cache written next to the .obj, valid while the source size and modification time match
+	bool load_cache(const char* filename);
+	void write_cache(const char* filename);
+
+	void upload_mesh(Mesh& mesh);
+
+	// Kept mapped between load and upload when the meshes come from the cache
+	Mapped_File cache_file;
+
+	// Maps a (position, uv, normal) index tuple to its vertex in the current mesh
+	std::unordered_map<uint64_t, uint32_t> corner_lookup;
 };
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glew.h>
+
+// Colour and depth renderbuffers behind a framebuffer object. Captures and benchmarks draw here, a windowless context has no
+// default framebuffer to draw into
+class Offscreen_Target {
+public:
+	Offscreen_Target();
+
+	bool init(int width, int height);
+	void destroy();
+
+	// Binds for drawing and reading and covers the whole target with the viewport
+	void bind();
+
+	int width;
+	int height;
+
+private:
+	GLuint framebuffer;
+	GLuint colour_buffer;
+	GLuint depth_buffer;
+};
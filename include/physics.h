@@ -5,6 +5,7 @@
 
 #include <Box2D\Box2D.h>
 
+#include "checkpoint.h"
 #include "maths.h"
 #include "types.h"
 #include "utils.h"
@@ -25,7 +26,12 @@ struct VehicleData {
 	int instance_id;
 };
 
-extern set<pair<VehicleData*, VehicleData*>> vehicle_collision_events;
+// Events are held by value and ordered by id so they resolve in the same order on every run
+inline bool operator < (const VehicleData& a, const VehicleData& b) {
+	return (a.instance_id != b.instance_id) ? a.instance_id < b.instance_id : a.is_predator < b.is_predator;
+}
+
+typedef set<pair<VehicleData, VehicleData>> Collision_Events;
 
 struct Boundary {
 	Boundary(b2World* world, const b2Vec2& position, float angle);
@@ -53,6 +59,9 @@ public:
 	float max_drive_force;
 	float max_lateral_impulse;
 
+	// Force applied since the last step, kept for checkpoints
+	b2Vec2 pending_force;
+
 	b2Body* body;
 };
 
@@ -65,6 +74,9 @@ public:
 	void init(b2World* world, b2Vec2 position, float rotation, bool is_predator, int index);
 	void update();
 
+	void save(Checkpoint_Writer& w) const;
+	void restore(b2World* world, Checkpoint_Reader& r, int index);
+
 	std::vector<Tyre*> tyres;
 	b2RevoluteJoint *fl_joint, *fr_joint;
 	b2Body* body;
@@ -75,9 +87,20 @@ public:
 
 	float desired_angle;
 	float desired_speed;
+
+private:
+	void build(b2World* world, b2Vec2 position, bool is_predator, int index, float max_forward_speed, float max_backward_speed, 
+		float back_tyre_max_drive_force, float front_tyre_max_drive_force, float back_tyre_max_lateral_impulse, float front_tyre_max_lateral_impulse);
 };
 
 class ContactListener : public b2ContactListener {
+public:
+	ContactListener() : collision_events(nullptr), begin_contacts(0) { }
+
+	Collision_Events* collision_events;
+	int begin_contacts;
+
+private:
 	void BeginContact(b2Contact* contact);
 };
 
@@ -93,6 +116,10 @@ public:
 	void				remove_vehicle();
 	void				remove_vehicle(int index);
 
+	// Every vehicle body, tyre and joint limit, restore expects a Physics constructed with no vehicles
+	void				save(Checkpoint_Writer& w) const;
+	bool				restore(Checkpoint_Reader& r);
+
 	b2Vec2 gravity;
 	b2World world;
 	Boundary *wall_1, *wall_2, *wall_3, *wall_4;
@@ -103,4 +130,10 @@ public:
 
 
 	ContactListener vehicle_contact_listener;
+
+	// Per world rather than global so several worlds can step on different threads
+	Collision_Events collision_events;
+
+	// Refreshed by every update
+	Physics_Profile profile;
 };
\ No newline at end of file
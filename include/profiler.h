@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <glew.h>
+
+#include "metrics.h"
+#include "renderer.h"
+
+// The last capacity samples, percentiles sort a copy so adding stays cheap
+class Rolling_Samples {
+public:
+	Rolling_Samples(size_t capacity = 240);
+
+	void add(float value);
+	float percentile(float p) const;
+	bool empty() const;
+
+private:
+	std::vector<float> samples;
+	size_t next;
+};
+
+// Frame, tick and render pass timings for the performance overlay. Simulation phases come from the differences in Metrics
+// between frames, so tick percentiles are over the mean tick of each frame. Every pass is also wrapped in a GL_TIME_ELAPSED
+// query that is read back a couple of frames later, never stalling on the GPU
+class Profiler {
+public:
+	enum Render_Pass { PASS_WALLS, PASS_BOUNDARIES, PASS_BODIES, PASS_WHEELS, PASS_SENSORS, PASS_UI, PASS_COUNT };
+	static const char* PASS_NAMES[PASS_COUNT];
+	static const char* PHASE_NAMES[Metrics::PHASE_COUNT];
+
+	Profiler();
+
+	void init();
+	void destroy();
+
+	void begin_frame();
+	void begin_pass(Render_Pass pass);
+	void end_pass(Render_Pass pass);
+	void end_frame(const Metrics& metrics);
+
+	Rolling_Samples frame_ms;
+	Rolling_Samples tick_ms;
+
+	// Smoothed milliseconds per frame
+	float phase_ms[Metrics::PHASE_COUNT];
+	float pass_ms[PASS_COUNT];
+	float gpu_pass_ms[PASS_COUNT];
+	float gpu_ms;
+
+	// Unsmoothed GPU times of the frame read back this end_frame, when gpu_sample_ready is set
+	float gpu_pass_sample[PASS_COUNT];
+	bool gpu_sample_ready;
+
+	int draw_calls;
+	long long triangles;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// Enough in flight that reading the oldest never waits on the GPU
+	static const int GPU_QUERY_FRAMES = 3;
+
+	Clock::time_point last_frame;
+	Clock::time_point pass_start;
+
+	uint64_t last_ticks;
+	uint64_t last_tick_nanoseconds;
+	uint64_t last_phase_nanoseconds[Metrics::PHASE_COUNT];
+
+	GLuint gpu_queries[GPU_QUERY_FRAMES][PASS_COUNT];
+	bool gpu_issued[GPU_QUERY_FRAMES][PASS_COUNT];
+	int gpu_frame;
+	bool has_queries;
+};
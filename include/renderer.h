@@ -1,9 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <map>
-
-#include <ft2build.h>
-#include FT_FREETYPE_H
+#include <unordered_map>
+#include <vector>
 
 #include <glew.h>
 
@@ -17,6 +19,22 @@
 using namespace maths;
 using namespace utils;
 
+// Draw calls and triangles submitted since the profiler last collected them
+struct Draw_Counters {
+	int draw_calls;
+	long long triangles;
+};
+
+extern Draw_Counters draw_counters;
+
+inline void count_draw(GLenum mode, size_t count, size_t instances = 1) {
+	draw_counters.draw_calls++;
+	if (mode == GL_TRIANGLES)
+		draw_counters.triangles += static_cast<long long>(count / 3) * instances;
+	else if (mode == GL_TRIANGLE_STRIP && count >= 3)
+		draw_counters.triangles += static_cast<long long>(count - 2) * instances;
+}
+
 class Circle_Renderer {
 public:
 	Circle_Renderer() { }
@@ -76,7 +94,7 @@ public:
 
 	void init();
 	void draw(const Camera& camera, const vec3& position, const vec3& size, float rotation, const vec4& colour);
-	void draw_multiple(const Camera& camera, std::map<int, Transform>& transform_list, std::map<int, Vehicle_Attributes>& vehicle_attributes, std::map<int, Light>& lights);
+	void draw_multiple(const Camera& camera, std::map<int, Transform>& transform_list, std::map<int, Vehicle_Attributes>& vehicle_attributes, const std::vector<int>& visible, std::map<int, Light>& lights);
 	void destroy();
 
 private:
@@ -102,43 +120,97 @@ private:
 
 class Model_Renderer {
 public:
-	Model_Renderer() { }
+	Model_Renderer() : vbo_instances(0), vbo_instances_capacity(0) { }
 
 	void init();
 	void draw_3D_coloured(Model& model, const Camera& camera, const Transform& transform, const vec4& colour);
 	void draw_3D_textured(Model& model, const Camera& camera, const Transform& transform, Texture& texture);
 	void draw_multiple_3D_textured(int n, Model& model, const Camera& camera, const std::vector<Transform>& transform_list, Texture& texture, std::map<int, Light>& lights);
-	void draw_multiple_3D_textured(int n, Model& model, const Camera& camera, std::map<int, std::vector<Transform>>& transform_list, Texture& texture, std::map<int, Light>& lights);
+	// Up to MAX_WHEELS wheels per vehicle, the size of the wheel arrays in v.MVP_NORMALS_UVS_WHEELS.glsl
+	static const int MAX_WHEELS = 8;
+	void draw_wheels_3D_textured(Model& model, const Camera& camera, const std::map<int, Transform>& vehicle_transforms, const std::map<int, Vehicle_Attributes>& vehicle_attributes, const std::vector<int>& visible, const std::vector<Wheel_Attributes>& wheel_attributes, Texture& texture, std::map<int, Light>& lights);
 	void destroy();
 
 private:
+	void set_lights(Shader& shader, std::map<int, Light>& lights);
+	void upload_instances(const void* data, size_t size);
+	void draw_instances_3D_textured(Model& model, const Camera& camera, Texture& texture, std::map<int, Light>& lights);
 
 	Shader shader_coloured;
 	Shader shader_textured;
+	Shader shader_textured_instanced;
+	Shader shader_wheels;
+
+	struct Model_Instance {
+		mat4 model;
+		mat4 normal;
+	};
+
+	// Per-instance data for the current draw, either a Model_Instance per model or a vec4 per vehicle for wheels
+	GLuint vbo_instances;
+	size_t vbo_instances_capacity;
+	std::vector<float> instance_components;
+	Aligned_Vector<mat4> instance_matrices;
+	Aligned_Vector<Model_Instance> model_instances;
+	std::vector<vec4> vehicle_instances;
 };
 
 class Text_Renderer {
 public:
-	Text_Renderer(int pixel_size = 24, const std::string& font = "") : pixel_size(pixel_size), font(font), vao(0), vbo(0) { }
+	Text_Renderer(int pixel_size = 24, const std::string& font = "") : pixel_size(pixel_size), font(font), vao(0), vbo(0), atlas_texture(0), vbo_capacity(0), glyphs(), atlas_height(0), rasterised(false) { }
 
+	// Builds the glyph atlas on the CPU only, so it can run on a worker thread ahead of init.
+	// Reads the baked <font>.<pixel_size>.atlas when it is current, otherwise bakes it with FreeType and writes it
+	void rasterise();
 	void init(const vec2& screen_resolution);
+
+	std::string baked_filename() const;
 	void draw(const std::string& msg, const vec2& position, bool centered, const vec4& colour);
+	void flush();
 	void destroy();
 
 	int pixel_size;
 	std::string font;
 
 private:
-	GLuint vao;
-	GLuint vbo;
-	Shader shader;
-
 	struct Glyph {
-		GLuint data;
-		FT_Pos next_glyph_offset;
+		float next_glyph_offset;
 		vec2 glyph_size;
 		vec2 bearing_offset;
+		vec4 uvs;
 	};
 
-	std::map<GLchar, Glyph> glyph_map;
+	struct Text_Vertex {
+		vec4 position_uv;
+		vec4 colour;
+	};
+
+	// Quads for a string laid out from a pen position of (0, 0), shared by every draw of the same text
+	struct Text_Layout {
+		float width;
+		std::vector<vec4> vertices;
+	};
+
+	const Text_Layout& layout(const std::string& msg);
+
+	bool load_baked();
+	void write_baked();
+	bool bake();
+
+	GLuint vao;
+	GLuint vbo;
+	GLuint atlas_texture;
+	size_t vbo_capacity;
+	Shader shader;
+
+	Glyph glyphs[128];
+
+	// Filled by rasterise and released once init has uploaded it
+	std::vector<unsigned char> atlas_pixels;
+	int atlas_height;
+	bool rasterised;
+
+	std::unordered_map<std::string, Text_Layout> layout_cache;
+	std::vector<Text_Vertex> batch;
+	std::vector<Text_Vertex> uploaded_batch;
 };
\ No newline at end of file
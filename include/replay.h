@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "types.h"
+
+using std::map;
+
+namespace replay {
+	// Fixed point steps the recorded fields are quantised to
+	const float POSITION_SCALE = 64.f;
+	const float HEADING_SCALE = 65536.f / 360.f;
+	const float ENERGY_SCALE = 100.f;
+	const float SPEED_SCALE = 16.f;
+
+	enum Field { X, Z, HEADING, ENERGY, SPEED, FIELD_COUNT };
+	enum Event_Kind { SPAWN, DESPAWN, CATCH };
+}
+
+struct Replay_Event {
+	replay::Event_Kind kind;
+	int id;
+	int other;
+};
+
+// One vehicle as the recording sees it, constants from its spawn and the last two quantised samples the deltas are predicted from
+struct Replay_Track {
+	bool is_predator;
+	float sensor_angle;
+	float sensor_offset;
+	float sensor_range;
+
+	int32_t value[replay::FIELD_COUNT];
+	int32_t previous[replay::FIELD_COUNT];
+	bool fresh;
+};
+
+// Append-only recording of a run, one record per tick holding that tick's events and each vehicle's state.
+// Most records only store the residual against a linear prediction from the two ticks before, every keyframe_interval-th is absolute
+class Replay_Recorder {
+public:
+	Replay_Recorder();
+
+	bool init(const char* filename, int keyframe_interval = 300);
+	void destroy();
+	bool is_open() const;
+
+	void spawn(int id, bool is_predator, const Vehicle_Sensors& sensors);
+	void despawn(int id);
+	void caught(int predator_id, int prey_id);
+	void record(int tick, const map<int, Transform>& transforms, const map<int, Vehicle_Attributes>& attributes);
+
+private:
+	std::ofstream ofs;
+	int keyframe_interval;
+	int records;
+
+	map<int, Replay_Track> tracks;
+	std::vector<uint8_t> event_bytes;
+	uint64_t event_count;
+	std::vector<uint8_t> payload;
+};
+
+// Decodes a recording through a mapped view, keyframes are indexed on init so seeking only decodes from the nearest one
+class Replay_Player {
+public:
+	Replay_Player();
+
+	bool init(const char* filename);
+	void destroy();
+	bool is_open() const;
+
+	bool step();
+	bool seek(int target_tick);
+
+	int tick;
+	int first_tick;
+	int last_tick;
+
+	map<int, Replay_Track> tracks;
+	std::vector<Replay_Event> events;
+
+private:
+	struct Keyframe {
+		int tick;
+		size_t offset;
+	};
+
+	bool decode(size_t offset);
+
+	Mapped_File file;
+	std::vector<Keyframe> keyframes;
+	size_t next_offset;
+	size_t end_offset;
+};
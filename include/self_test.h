@@ -0,0 +1,5 @@
+#pragma once
+
+// Known answer checks for the hashing, replay, checkpoint, branching and vertex packing code, run with --self-test.
+// Prints every failed check and returns the process exit code, 0 when all of them pass
+int run_self_test();
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <glew.h>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <string>
 
+#include "asset_pack.h"
 #include "maths.h"
 
 namespace utils {
@@ -33,7 +36,12 @@ namespace utils {
 	private:
 		std::string load_source(const char* filename);
 		void compile(GLuint shader, const char* src);
-		void link();
+		bool link();
+
+		// Every constructor funnels through here, a cached program binary is tried before compiling the stages
+		void build(const GLenum* stages, const char* const* filenames, int count);
+		bool load_binary(const std::string& cache_filename, uint64_t hash);
+		void save_binary(const std::string& cache_filename, uint64_t hash);
 
 		const char* v_shader_filename;
 		const char* f_shader_filename;
@@ -1,36 +1,110 @@
 #pragma once
 
+#include <atomic>
+#include <cstdio>
 #include <map>
+#include <sstream>
+#include <thread>
 
 #include <glew.h>
 #include <glfw3.h>
 
+#include "asset_pack.h"
 #include "camera.h"
 #include "inactivity_timer.h"
 #include "maths.h"
+#include "metrics.h"
 #include "model.h"
 #include "physics.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "replay.h"
+#include "state_hash.h"
+#include "stats.h"
 #include "types.h"
 #include "ui.h"
+#include "video_capture.h"
 
 using namespace maths;
 using namespace utils;
 
+// A what-if applied to a copy of the world before it runs on, extra vehicles and sensor scaling only touch vehicles alive at the fork
+struct Branch {
+	Branch() : seed(0), extra_predators(0), extra_prey(0), sensor_range_scale(1.f) { }
+
+	uint32_t seed;	// 0 keeps the random state of the original run
+	int extra_predators;
+	int extra_prey;
+	float sensor_range_scale;
+};
+
+struct Branch_Result {
+	bool restored;
+	int tick;
+	int generation;
+	int predators;
+	int prey;
+	int catches;
+	float mean_energy;
+	uint64_t state_hash;
+};
+
 class Simulation {
 public:
 	Simulation();
 
+	// A bare world with only the walls, no vehicles, UI or text renderer, for branches that restore a checkpoint straight away
+	explicit Simulation(bool populate);
+
 	void init();
 	void update();
 	void draw();
 	void destroy();
 
+	// Bakes every asset into its runtime format and bundles them with the shaders into one pack, needs no GL context
+	static bool build_asset_pack(const char* filename);
+
+	// Steps the world as fast as it goes without a window or GL context
+	void run_headless(int ticks);
+
+	// Renders frames offscreen back to back while the camera makes one orbit over a frozen world, then writes frame time and
+	// draw statistics to filename
+	bool run_benchmark(int frames, const char* filename);
+
+	// Runs and renders the given number of frames offscreen, writing each one to a video file
+	bool run_capture(int frames, const char* filename);
+
+	bool start_recording(const char* filename);
+
+	// Swaps physics for a recording, update then plays it back and draw renders it as usual
+	bool load_replay(const char* filename);
+	void seek_replay(int ticks);
+	void update_from_replay();
+
+	void resolve_catches();
+	void step();
+
+	// Whole world state including every Box2D body. Saving rebuilds this world from the saved bytes, so it carries on exactly as
+	// anything restored from them does
+	void checkpoint(std::vector<uint8_t>& bytes);
+	bool restore(const uint8_t* data, size_t size);
+	bool save_checkpoint(const char* filename);
+	bool load_checkpoint(const char* filename);
+
+	// Each branch restores its own copy of the checkpoint into a bare world on a worker thread and runs headless for the given
+	// ticks. checkpoint rebuilt the world that saved it, so a branch that changes nothing stays in step with that world
+	static void run_branches(const std::vector<uint8_t>& checkpoint, const std::vector<Branch>& branches, int ticks, std::vector<Branch_Result>& results);
+	void apply_branch(const Branch& branch);
+
+	// Fingerprint of every vehicle's id, type, pose, velocities and energy, logged after each tick while hash_log is open
+	uint64_t state_hash();
+
 	void update_simulation_transforms_from_physics();
 	void update_sensors_from_simulation_transforms();
 	void check_detected_walls();
 	void check_detected_vehicles();
 	void predator_prey();
+	void cull_vehicles();
 
 	void add_vehicle(bool is_predator);
 	void remove_vehicle();
@@ -57,15 +131,30 @@ public:
 
 	Inactivity_Timer inactivity_timer;
 
+	Replay_Recorder recorder;
+	Replay_Player player;
+	State_Hash_Log hash_log;
+	Stats stats;
+	Metrics metrics;
+	Metrics_Server metrics_server;
+	Profiler profiler;
+
 	bool mouse_pressed;
 	bool is_updating;
 	bool is_drawing;
+	bool has_context;
 
 	bool draw_sensors;
 	bool draw_sensor_outlines;
+	bool draw_profiler;
 
 	int index_state;
 	int generation;
+	int tick;
+
+	// Saved every checkpoint_interval ticks while a filename is set
+	string checkpoint_filename;
+	int checkpoint_interval;
 
 	vec2 cursor_position;
 
@@ -74,7 +163,7 @@ public:
 	vector<Transform>			transforms_boundaries;
 	vector<Wheel_Attributes>	attributes_wheels;
 	
-	static int instance_id;
+	int instance_id;
 
 	// Vehicle Properties
 	map<int, Vehicle_Attributes>	attributes_vehicles;
@@ -82,5 +171,8 @@ public:
 	map<int, Vehicle_Sensors>		vehicle_sensors;
 	map<int, Transform>				transforms_vehicles;
 	map<int, Transform>				old_transforms_vehicles;
-	map<int, vector<Transform>>		transforms_wheels;
+
+	// Rebuilt each frame by cull_vehicles, ids of vehicles whose body and wheels or sensors intersect the view frustum
+	vector<int>						visible_vehicles;
+	vector<int>						visible_sensors;
 };
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+
+// XXH64 over a byte range
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed = 0);
+
+// One (tick, hash) pair per simulated tick, two logs of the same seeded run should match tick for tick
+class State_Hash_Log {
+public:
+	bool init(const char* filename);
+	void destroy();
+	bool is_open() const;
+
+	void write(int tick, uint64_t hash);
+
+	// Prints the first tick both logs cover where the hashes differ, returns 0 when none does, 1 on divergence and 2 on error
+	static int compare(const char* filename_a, const char* filename_b);
+
+private:
+	std::ofstream ofs;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+#include "types.h"
+
+using std::map;
+
+// One row of the stats stream, counts are for the interval the row closes, populations and energies as of its end
+struct Stats_Sample {
+	int tick;
+	int generation;
+	int predators;
+	int prey;
+	int births;
+	int deaths;
+	int catches;
+	float mean_energy;
+	float min_energy;
+	float max_energy;
+	float mean_speed;
+
+	// Timings are means over the interval, counts as of its last step except begin_contacts which is summed
+	Physics_Profile physics;
+
+	// Mean GPU time of each render pass over the frames read back in the interval, zero when nothing was drawn
+	float gpu_ms[Profiler::PASS_COUNT];
+};
+
+// Population counters kept up to date as vehicles come and go, plus per-interval aggregates written out as CSV.
+// Rows are queued to a writer thread so the simulation thread never waits on the file
+class Stats {
+public:
+	Stats();
+
+	bool init(const char* filename, int interval = 30);
+	void destroy();
+	bool is_open() const;
+
+	void born(bool is_predator);
+	void died(bool is_predator);
+	void caught();
+	void recount(const map<int, Vehicle_Attributes>& attributes);
+
+	// Fed once per vehicle per tick, end_tick closes a row every interval ticks
+	void observe(float energy, float speed);
+	void observe_physics(const Physics_Profile& profile);
+	void observe_gpu(const float pass_ms[Profiler::PASS_COUNT]);
+	void end_tick(int tick, int generation);
+
+	int predators;
+	int prey;
+
+	// Totals since construction
+	int births;
+	int deaths;
+	int catches;
+
+private:
+	void write_rows();
+	void reset_interval();
+
+	int interval;
+	Stats_Sample current;
+	int observations;
+	double energy_sum;
+	double speed_sum;
+	int physics_steps;
+	Physics_Profile physics_sum;
+	int gpu_frames;
+	double gpu_sum[Profiler::PASS_COUNT];
+
+	std::ofstream ofs;
+	std::thread writer;
+	std::mutex queue_mutex;
+	std::condition_variable queue_ready;
+	std::vector<Stats_Sample> queue;
+	bool stopping;
+};
@@ -1,15 +1,39 @@
 #pragma once
 
+#include "asset_pack.h"
+#include "mapped_file.h"
 #include "utils.h"
 
 #include <glew.h>
 
+#include <vector>
+
+// RGB mip chain ready for upload, data points into the asset pack, the mapped cache or pixels
+struct Texture_Data {
+	Texture_Data();
+
+	int width;
+	int height;
+	int levels;
+
+	const unsigned char* data;
+	std::vector<unsigned char> pixels;
+	Mapped_File cache;
+};
+
+// tex stays 0 until a texture is uploaded, so one that failed to load is neither bound nor deleted
 class Texture {
 public:
+	Texture() : tex(0) { }
+
 	void init(const char* filename);
 	void use();
 	void destroy();
 
+	// Safe to call off the GL thread, reads <filename>.cache from the asset pack or disk when current and writes it otherwise
+	static bool decode(const char* filename, Texture_Data& out);
+	void upload(const Texture_Data& data);
+
 private:
 	GLuint tex;
-};
\ No newline at end of file
+};
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "maths.h"
-#include <Box2D\Box2D.h>
 #include <vector>
 
 namespace {
@@ -27,6 +26,23 @@ struct Vehicle_Attributes {
 	bool is_predator;
 	float energy;
 	int id;
+	float speed;
+};
+
+// Box2D's timings for one step in milliseconds and what the world held once it finished
+struct Physics_Profile {
+	float step;
+	float collide;
+	float solve;
+	float solve_toi;
+	float broadphase;
+
+	int bodies;
+	int awake_bodies;
+	int contacts;
+	int touching_contacts;
+	int joints;
+	int begin_contacts;	// BeginContact callbacks during the step, whatever the fixtures
 };
 
 struct Detection_Event {
@@ -43,9 +59,11 @@ struct Vehicle_Sensors {
 	std::vector<Detection_Event> detection_events;
 };
 
+// Placement of one wheel around a vehicle, the wheel transform itself is derived in v.MVP_NORMALS_UVS_WHEELS.glsl
 struct Wheel_Attributes {
-	Transform gen_transform_from_vehicle(const b2Vec2& forward_velocity, const Transform& t, float wheel_dist);
-
 	float angular_offset;
 	float y_rotation;
+	float distance;
+	float height;
+	vec3 size;
 };
\ No newline at end of file
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <random>
 #include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
 
 #include "maths.h"
 #include "types.h"
@@ -12,10 +18,6 @@ namespace utils {
 
 	
 
-	struct dimensions {
-		int width, height;
-	};
-
 	static int line_count(const char* filename) {
 		int count = 0;
 		std::string line;
@@ -28,21 +30,24 @@ namespace utils {
 		return count;
 	}
 
-	static dimensions png_dimensions(const char* filename) {
-		std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
-
-		file.seekg(16, std::ios_base::cur);
+	// Size and modification time of a file, used to tell whether a derived cache is still current
+	static bool file_stamp(const char* filename, uint64_t& size, int64_t& time) {
+		struct stat st;
+		if (stat(filename, &st) != 0)
+			return false;
 
-		__int32 width;
-		__int32 height;
-
-		file.read((char*)&width, 4);
-		file.read((char*)&height, 4);
+		size = static_cast<uint64_t>(st.st_size);
+		time = static_cast<int64_t>(st.st_mtime);
+		return true;
+	}
 
-		file.close();
+	// Files that are mapped or trusted on the next run are written to temp_filename and swapped in by commit_file, so a crash or
+	// a full disk never leaves a torn file under the real name. The temp name carries the process and thread, so writers racing
+	// on the same file never share one, and the same thread gets the same name back when it commits
+	std::string temp_filename(const char* filename);
 
-		return{ (int)_byteswap_ulong(width), (int)_byteswap_ulong(height) };
-	}
+	// Replaces filename in one step, readers see either the old file or the new one and never a gap between them
+	bool commit_file(std::ofstream& ofs, const char* filename);
 
 	static float elapsed_time() {
 		using namespace std::chrono;
@@ -50,11 +55,13 @@ namespace utils {
 		return duration_cast<duration<float>>(steady_clock::now() - start).count();
 	}
 
+	// One engine per thread shared by every translation unit, so a run can be seeded and its state saved in a checkpoint
+	std::mt19937& random_engine();
+	void seed_random(uint32_t seed);
+
 	static float gen_random(float min = 0.f, float max = 10.f) {
-		static std::random_device rd;
-		static std::mt19937 mt(rd());
 		std::uniform_real_distribution<float> dist(min, max);
-		return dist(mt);
+		return dist(random_engine());
 	}
 
 	static vec2 gen_random(vec2 min, vec2 max) {
@@ -76,32 +83,38 @@ namespace utils {
 	}
 
 	static mat4 gen_model_matrix(const vec2& size, const vec2& position) {
-		mat4 s = scale(vec3{size, 0.f});
-		mat4 t = transpose(translate(vec3{position, 0.f}));
-		return mult(s, t);
+		return model_matrix(vec3{size, 0.f}, vec3{position, 0.f}, vec3{0.f});
 	}
 
 	static mat4 gen_model_matrix(const vec3& size, const vec3& position, float rotation) {
-		mat4 s = scale(size);
-		mat4 t = transpose(translate(position));
-		mat4 r = rotate_y(rotation);
-		return mult(mult(s, r), t);
+		return model_matrix(size, position, vec3{0.f, rotation, 0.f});
 	}
 
 	static mat4 gen_model_matrix(const vec3& size, const vec3& position, const vec3& rotation) {
-		mat4 s = scale(size);
-		mat4 t = transpose(translate(position));
-		mat4 r = rotate(rotation);
-		
-		return mult(mult(s, r), t);
+		return model_matrix(size, position, rotation);
 	}
 
 	static mat4 gen_model_matrix(const Transform& transform) {
-		mat4 s = scale(transform.size);
-		mat4 t = transpose(translate(transform.position));
-		mat4 r = rotate(transform.rotation);
+		return model_matrix(transform.size, transform.position, transform.rotation);
+	}
+
+	// Splits the first count transforms into components for model_matrices, which is what components is kept around for
+	static void gen_model_matrices(const std::vector<Transform>& transforms, size_t count, std::vector<float>& components, Aligned_Vector<mat4>& out) {
+		out.resize(count);
+		components.resize(count * 9);
+
+		float* c[9];
+		for (int k = 0; k < 9; k++)
+			c[k] = components.data() + k * count;
+
+		for (size_t i = 0; i < count; i++) {
+			const Transform& t = transforms[i];
+			c[0][i] = t.size.x;     c[1][i] = t.size.y;     c[2][i] = t.size.z;
+			c[3][i] = t.position.x; c[4][i] = t.position.y; c[5][i] = t.position.z;
+			c[6][i] = t.rotation.x; c[7][i] = t.rotation.y; c[8][i] = t.rotation.z;
+		}
 
-		return mult(mult(s, r), t);
+		model_matrices(c, c + 3, c + 6, count, out.data());
 	}
 
 	namespace config {
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glew.h>
+
+#include "offscreen_target.h"
+
+// Renders into an Offscreen_Target and streams every frame to a video file, Y4M when the name ends in .y4m and raw RGB24 otherwise.
+// glReadPixels only queues a copy into one of a ring of pixel buffers, each is mapped PIXEL_BUFFERS - 1 frames later once the copy
+// has long finished, and a writer thread converts and writes the frames
+class Video_Capture {
+public:
+	Video_Capture();
+
+	bool init(const char* filename, int width, int height, int fps = 30);
+	void destroy();
+	bool is_open() const;
+
+	// Everything drawn between the two lands in the video instead of the window
+	void begin_frame();
+	void end_frame();
+
+private:
+	static const int PIXEL_BUFFERS = 3;
+
+	// Frames waiting on the writer before end_frame holds back, bounds memory when the disk is slower than the renderer
+	static const size_t MAX_QUEUED_FRAMES = 8;
+
+	void read_back(int index);
+	void write_frames();
+	void write_y4m(const std::vector<uint8_t>& rgba);
+	void write_rgb(const std::vector<uint8_t>& rgba);
+
+	int width;
+	int height;
+	bool is_y4m;
+
+	Offscreen_Target target;
+	GLuint pixel_buffers[PIXEL_BUFFERS];
+	int frames_read;
+	int frames_queued;
+
+	std::ofstream ofs;
+	std::vector<uint8_t> converted;
+
+	std::thread writer;
+	std::mutex queue_mutex;
+	std::condition_variable queue_changed;
+	std::vector<std::vector<uint8_t>> queue;
+	std::vector<std::vector<uint8_t>> spare;
+	bool stopping;
+};
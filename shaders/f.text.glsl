@@ -1,12 +1,12 @@
 #version 450
 
 in vec2 tex_coord;
+in vec4 text_colour;
 out vec4 frag_colour;
 
 uniform sampler2D tex0;
-uniform vec4 colour;
 
 void main() {
 	vec4 c = vec4(1.0, 1.0, 1.0, texture(tex0, tex_coord).r);
-	frag_colour = c * colour;
+	frag_colour = c * text_colour;
 };
\ No newline at end of file
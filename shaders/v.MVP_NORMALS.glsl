@@ -4,17 +4,15 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 
 uniform mat4 model;
-uniform mat4 projection;
-uniform mat4 view;
+uniform mat4 normal_matrix; // Inverse transpose of model, precomputed on the CPU
+uniform mat4 view_projection;
 
 out vec3 normal_out;
 out vec3 fragpos_out;
 
 void main() {
-	gl_Position = projection * view * model * vec4(position, 1.0);
-
-	// Generate normal matrix, as using non-uniform scale
-	normal_out = mat3(transpose(inverse(model))) * normal;
-	
-	fragpos_out = vec3(model * vec4(position, 1.0));
+	vec4 world_position = model * vec4(position, 1.0);
+	gl_Position = view_projection * world_position;
+	normal_out = mat3(normal_matrix) * normal;
+	fragpos_out = world_position.xyz;
 };
\ No newline at end of file
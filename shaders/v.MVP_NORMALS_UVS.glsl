@@ -5,8 +5,8 @@ layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 uv;
 
 uniform mat4 model;
-uniform mat4 projection;
-uniform mat4 view;
+uniform mat4 normal_matrix; // Inverse transpose of model, precomputed on the CPU
+uniform mat4 view_projection;
 
 out vec3 normal_out;
 out vec2 uv_out;
@@ -14,8 +14,9 @@ out vec3 fragpos_out;
 
 
 void main() {
-	gl_Position = projection * view * model * vec4(position, 1.0);
-	normal_out = mat3(transpose(inverse(model))) * normal;
+	vec4 world_position = model * vec4(position, 1.0);
+	gl_Position = view_projection * world_position;
+	normal_out = mat3(normal_matrix) * normal;
 	uv_out = uv;
-	fragpos_out = vec3(model * vec4(position, 1.0));
+	fragpos_out = world_position.xyz;
 };
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 450
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+layout(location = 3) in mat4 model;
+layout(location = 7) in mat3 normal_matrix;
+
+uniform mat4 view_projection;
+
+out vec3 normal_out;
+out vec2 uv_out;
+out vec3 fragpos_out;
+
+
+void main() {
+	vec4 world_position = model * vec4(position, 1.0);
+	gl_Position = view_projection * world_position;
+	normal_out = normal_matrix * normal;
+	uv_out = uv;
+	fragpos_out = world_position.xyz;
+};
\ No newline at end of file
@@ -0,0 +1,58 @@
+#version 450
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+layout(location = 3) in vec4 vehicle; // x, z, y rotation (degrees), speed
+
+uniform mat4 view_projection;
+
+// Model_Renderer::MAX_WHEELS
+const int MAX_WHEELS = 8;
+
+uniform int wheel_count;
+uniform vec4 wheels[MAX_WHEELS]; // angular offset, y rotation, distance from the vehicle, height
+uniform vec3 wheel_sizes[MAX_WHEELS];
+
+out vec3 normal_out;
+out vec2 uv_out;
+out vec3 fragpos_out;
+
+// Same layout as maths::rotate_y/rotate_z once uploaded, so products are in reverse order to gen_model_matrix
+mat4 rotate_y(float degrees) {
+	float c = cos(radians(degrees));
+	float s = sin(radians(degrees));
+	return mat4(vec4(c, 0.0, s, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(-s, 0.0, c, 0.0), vec4(0.0, 0.0, 0.0, 1.0));
+}
+
+mat4 rotate_z(float degrees) {
+	float c = cos(radians(degrees));
+	float s = sin(radians(degrees));
+	return mat4(vec4(c, -s, 0.0, 0.0), vec4(s, c, 0.0, 0.0), vec4(0.0, 0.0, 1.0, 0.0), vec4(0.0, 0.0, 0.0, 1.0));
+}
+
+void main() {
+	int wheel_index = gl_InstanceID % wheel_count;
+	vec4 wheel = wheels[wheel_index];
+	vec3 wheel_size = wheel_sizes[wheel_index];
+
+	float placement = radians(vehicle.z - wheel.x);
+	vec3 wheel_position = vec3(vehicle.x + cos(placement) * wheel.z, wheel.w, vehicle.y + sin(placement) * wheel.z);
+
+	float spin = vehicle.w * 3.0;
+	float z_rotation = 0.5 + ((wheel.y == 0.0) ? spin : -spin);
+
+	mat4 translation = mat4(vec4(1.0, 0.0, 0.0, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(0.0, 0.0, 1.0, 0.0), vec4(wheel_position, 1.0));
+	mat4 scale = mat4(vec4(wheel_size.x, 0.0, 0.0, 0.0), vec4(0.0, wheel_size.y, 0.0, 0.0), vec4(0.0, 0.0, wheel_size.z, 0.0), vec4(0.0, 0.0, 0.0, 1.0));
+	mat4 rotation = rotate_y(vehicle.z + wheel.y) * rotate_z(z_rotation);
+	mat4 model = translation * rotation * scale;
+
+	// Rotations are orthonormal, so the inverse transpose only needs the reciprocal scale
+	mat3 normal_matrix = mat3(rotation) * mat3(vec3(1.0 / wheel_size.x, 0.0, 0.0), vec3(0.0, 1.0 / wheel_size.y, 0.0), vec3(0.0, 0.0, 1.0 / wheel_size.z));
+
+	vec4 world_position = model * vec4(position, 1.0);
+	gl_Position = view_projection * world_position;
+	normal_out = normal_matrix * normal;
+	uv_out = uv;
+	fragpos_out = world_position.xyz;
+};
\ No newline at end of file
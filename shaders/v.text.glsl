@@ -1,12 +1,15 @@
 #version 450
 
 layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 colour;
 
 out vec2 tex_coord;
+out vec4 text_colour;
 
 uniform mat4 projection;
 
 void main() {
 	gl_Position = projection * vec4(position.xy, 0.0, 1.0);
 	tex_coord = vec2(position.zw);
+	text_colour = colour;
 };
\ No newline at end of file
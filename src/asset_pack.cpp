@@ -0,0 +1,232 @@
+#include "..\include\asset_pack.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "..\include\utils.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+Asset_Pack asset_pack;
+
+namespace {
+	const char ASSET_PACK_MAGIC[4] = { 'G', 'L', 'V', 'A' };
+	const uint32_t ASSET_PACK_VERSION = 2;
+
+	// Payloads start on this boundary so mapped vertex and index data can be used in place
+	const uint64_t ASSET_ALIGNMENT = 16;
+
+	struct Asset_Pack_Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t entry_count;
+		uint32_t names_size;
+	};
+
+	struct Asset_Pack_Entry {
+		uint64_t offset;
+		uint64_t size;
+		uint64_t source_size;
+		int64_t source_time;
+		uint32_t name_offset;
+		uint32_t name_length;
+		uint32_t source_offset;
+		uint32_t source_length;
+	};
+
+	std::string normalise_path(std::string path) {
+		for (size_t i = 0; i < path.size(); i++) {
+			if (path[i] == '\\')
+				path[i] = '/';
+		}
+		return path;
+	}
+
+	uint64_t align(uint64_t offset) {
+		return (offset + ASSET_ALIGNMENT - 1) & ~(ASSET_ALIGNMENT - 1);
+	}
+}
+
+bool Asset_Pack::init(const char* filename) {
+	destroy();
+
+	if (!file.init(filename))
+		return false;
+
+	const Asset_Pack_Header* header = reinterpret_cast<const Asset_Pack_Header*>(file.data);
+	if (file.size < sizeof(Asset_Pack_Header) || memcmp(header->magic, ASSET_PACK_MAGIC, 4) != 0 || header->version != ASSET_PACK_VERSION) {
+		std::cout << filename << " is not a compatible asset pack" << std::endl;
+		destroy();
+		return false;
+	}
+
+	// Sizes are checked against what is left of the file before any pointer is formed, a damaged count must not wrap around
+	size_t remaining = file.size - sizeof(Asset_Pack_Header);
+	if (header->entry_count > remaining / sizeof(Asset_Pack_Entry) || header->names_size > remaining - header->entry_count * sizeof(Asset_Pack_Entry)) {
+		std::cout << filename << " is not a compatible asset pack" << std::endl;
+		destroy();
+		return false;
+	}
+
+	const Asset_Pack_Entry* index = reinterpret_cast<const Asset_Pack_Entry*>(file.data + sizeof(Asset_Pack_Header));
+	const char* names = reinterpret_cast<const char*>(index + header->entry_count);
+
+	entries.reserve(header->entry_count);
+	int stale = 0;
+	for (uint32_t i = 0; i < header->entry_count; i++) {
+		const Asset_Pack_Entry& e = index[i];
+		if (e.name_offset > header->names_size || e.name_length > header->names_size - e.name_offset ||
+			e.source_offset > header->names_size || e.source_length > header->names_size - e.source_offset ||
+			e.offset > file.size || e.size > file.size - e.offset)
+			continue;
+
+		// Staleness is settled here once, a source that is not on disk is fine as a shipped pack need not come with them
+		std::string source(names + e.source_offset, e.source_length);
+		uint64_t source_size;
+		int64_t source_time;
+		if (utils::file_stamp(source.c_str(), source_size, source_time) && (source_size != e.source_size || source_time != e.source_time)) {
+			stale++;
+			continue;
+		}
+
+		Entry entry = { file.data + e.offset, static_cast<size_t>(e.size) };
+		entries[std::string(names + e.name_offset, e.name_length)] = entry;
+	}
+
+	if (stale > 0)
+		std::cout << "Ignoring " << stale << " assets in " << filename << " whose sources have changed" << std::endl;
+
+	return true;
+}
+
+void Asset_Pack::destroy() {
+	entries.clear();
+	file.destroy();
+}
+
+bool Asset_Pack::is_open() const {
+	return file.data != nullptr;
+}
+
+bool Asset_Pack::find(const std::string& name, const char*& data, size_t& size) const {
+	if (entries.empty())
+		return false;
+
+	std::unordered_map<std::string, Entry>::const_iterator it = entries.find(normalise_path(name));
+	if (it == entries.end())
+		return false;
+
+	data = it->second.data;
+	size = it->second.size;
+	return true;
+}
+
+bool Asset_Pack::build(const char* filename, const std::vector<std::string>& files, const std::vector<std::string>& sources) {
+	std::vector<Asset_Pack_Entry> index(files.size());
+	std::string names;
+
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!utils::file_stamp(sources[i].c_str(), index[i].source_size, index[i].source_time)) {
+			std::cout << "Missing source " << sources[i] << " for " << files[i] << std::endl;
+			return false;
+		}
+
+		std::string name = normalise_path(files[i]);
+		index[i].name_offset = static_cast<uint32_t>(names.size());
+		index[i].name_length = static_cast<uint32_t>(name.size());
+		names += name;
+
+		std::string source = normalise_path(sources[i]);
+		index[i].source_offset = static_cast<uint32_t>(names.size());
+		index[i].source_length = static_cast<uint32_t>(source.size());
+		names += source;
+	}
+
+	Asset_Pack_Header header;
+	memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+	header.version = ASSET_PACK_VERSION;
+	header.entry_count = static_cast<uint32_t>(files.size());
+	header.names_size = static_cast<uint32_t>(names.size());
+
+	std::ofstream ofs(utils::temp_filename(filename).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to write " << filename << std::endl;
+		return false;
+	}
+
+	// Header and index are rewritten once the payload offsets are known
+	uint64_t offset = align(sizeof(header) + sizeof(Asset_Pack_Entry) * index.size() + names.size());
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(index.data()), sizeof(Asset_Pack_Entry) * index.size());
+	ofs.write(names.data(), names.size());
+
+	const char zeros[ASSET_ALIGNMENT] = {};
+	uint64_t position = sizeof(header) + sizeof(Asset_Pack_Entry) * index.size() + names.size();
+
+	for (size_t i = 0; i < files.size(); i++) {
+		Mapped_File source;
+		if (!source.init(files[i].c_str())) {
+			ofs.close();
+			std::remove(utils::temp_filename(filename).c_str());
+			return false;
+		}
+
+		ofs.write(zeros, offset - position);
+		ofs.write(source.data, source.size);
+
+		index[i].offset = offset;
+		index[i].size = source.size;
+
+		position = offset + source.size;
+		offset = align(position);
+	}
+
+	ofs.seekp(sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(index.data()), sizeof(Asset_Pack_Entry) * index.size());
+	if (!utils::commit_file(ofs, filename))
+		return false;
+
+	std::cout << "Packed " << files.size() << " assets into " << filename << std::endl;
+	return true;
+}
+
+void Asset_Pack::list_files(const char* directory, const char* extension, std::vector<std::string>& files) {
+	std::string dir = directory;
+	size_t extension_length = strlen(extension);
+
+	std::vector<std::string> names;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE handle = FindFirstFileA((dir + "\\*").c_str(), &found);
+	if (handle == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			names.push_back(found.cFileName);
+	} while (FindNextFileA(handle, &found));
+
+	FindClose(handle);
+#else
+	DIR* handle = opendir(directory);
+	if (handle == nullptr)
+		return;
+
+	while (dirent* found = readdir(handle)) {
+		if (found->d_name[0] != '.')
+			names.push_back(found->d_name);
+	}
+
+	closedir(handle);
+#endif
+
+	for (size_t i = 0; i < names.size(); i++) {
+		const std::string& name = names[i];
+		if (name.size() >= extension_length && name.compare(name.size() - extension_length, extension_length, extension) == 0)
+			files.push_back(dir + "/" + name);
+	}
+}
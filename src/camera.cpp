@@ -16,6 +16,8 @@ Camera::Camera() {
 	matrix_view = shared::view_matrix(position_current, position_target, orientation_up);
 	matrix_projection_ortho = orthographic_matrix(resolution, depth_range_ortho.x, depth_range_ortho.y, maths::mat4());
 	matrix_projection_persp = shared::perspective_matrix(field_of_view, aspect_ratio, depth_range_persp.x, depth_range_persp.y);
+	matrix_view_projection = mult(matrix_view, matrix_projection_persp);
+	update_frustum();
 
 	list_position_current = {
 		{    0.f, 256.f,  352.f },
@@ -52,6 +54,7 @@ Camera::Camera() {
 		{  -88.f, 256.f,  352.f },
 	};
 	index_list_position_current = 0;
+	path_blend = 0.f;
 	height = 256.f;
 
 }
@@ -73,7 +76,8 @@ void Camera::update(std::map<int, Transform>& transforms) {
 	}
 	else {
 		//position_current = position_start;
-		position_current = list_position_current[index_list_position_current];
+		int index_next = (index_list_position_current + 1) % list_position_current.size();
+		position_current = lerp(list_position_current[index_list_position_current], list_position_current[index_next], path_blend);
 		position_current.y = height;
 		position_target = vec3{ 0.f, 0.f, 0.f };
 		//orientation_up = vec3(0.f, 0.f, 1.f);
@@ -81,4 +85,48 @@ void Camera::update(std::map<int, Transform>& transforms) {
 	}
 
 	matrix_view = shared::view_matrix(position_current, position_target, orientation_up);
+	matrix_view_projection = mult(matrix_view, matrix_projection_persp);
+	update_frustum();
+}
+
+void Camera::update_frustum() {
+	// Uploaded transposed, so the rows GL multiplies by are the columns of matrix_view_projection
+	const mat4& m = matrix_view_projection;
+	vec4 row_x = { m.x.x, m.y.x, m.z.x, m.w.x };
+	vec4 row_y = { m.x.y, m.y.y, m.z.y, m.w.y };
+	vec4 row_z = { m.x.z, m.y.z, m.z.z, m.w.z };
+	vec4 row_w = { m.x.w, m.y.w, m.z.w, m.w.w };
+
+	frustum_planes[0] = row_w + row_x;
+	frustum_planes[1] = row_w - row_x;
+	frustum_planes[2] = row_w + row_y;
+	frustum_planes[3] = row_w - row_y;
+	frustum_planes[4] = row_w + row_z;
+	frustum_planes[5] = row_w - row_z;
+
+	for (int i = 0; i < 6; i++)
+		frustum_planes[i] /= magnitude(frustum_planes[i].XYZ());
+}
+
+bool Camera::sphere_visible(const vec3& centre, float radius) const {
+	for (int i = 0; i < 6; i++) {
+		const vec4& p = frustum_planes[i];
+		if (p.x * centre.x + p.y * centre.y + p.z * centre.z + p.w < -radius)
+			return false;
+	}
+
+	return true;
+}
+
+bool Camera::aabb_visible(const vec3& min, const vec3& max) const {
+	// Only the corner furthest along each plane normal needs testing
+	for (int i = 0; i < 6; i++) {
+		const vec4& p = frustum_planes[i];
+		vec3 corner = { (p.x >= 0.f) ? max.x : min.x, (p.y >= 0.f) ? max.y : min.y, (p.z >= 0.f) ? max.z : min.z };
+
+		if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.f)
+			return false;
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -4,7 +4,10 @@
 #pragma comment(lib, "freetype265MT.lib")
 #pragma comment(lib, "SOIL.lib")
 #pragma comment(lib, "Box2D.lib")
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "psapi.lib")
 
+#include "..\include\self_test.h"
 #include "..\include\simulation.h"
 #include "..\include\utils.h"
 
@@ -19,7 +22,11 @@ namespace {
 		if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_PRESS) {
 			Simulation* s = reinterpret_cast<Simulation*>(glfwGetWindowUserPointer(window));
 
+			// A replay has no physics world to add vehicles to or reset
 			int active_button = s->ui.index_active_button;
+			if (s->player.is_open() && (active_button == 0 || active_button == 1 || active_button == 5))
+				return;
+
 			switch (active_button) {
 				case 0: s->add_vehicle(gen_random(0.f, 1.f) > 0.5f);			break;
 				case 1: s->remove_vehicle();									break;
@@ -30,6 +37,7 @@ namespace {
 				case 6: glfwSetWindowShouldClose(window, GLFW_TRUE);			break;
 				case 7: s->draw_sensors = !s->draw_sensors;						break;
 				case 8: s->draw_sensor_outlines = !s->draw_sensor_outlines;		break;
+				case 9: s->draw_profiler = !s->draw_profiler;					break;
 			}
 		}
 	}
@@ -57,13 +65,183 @@ namespace {
 				case GLFW_KEY_DOWN: 
 					s->camera.height -= 32.f;
 					break;
+				case GLFW_KEY_P:
+					s->draw_profiler = !s->draw_profiler;
+					break;
+				case GLFW_KEY_PAGE_UP:
+					s->seek_replay(300);
+					break;
+				case GLFW_KEY_PAGE_DOWN:
+					s->seek_replay(-300);
+					break;
 			}
 			
 		}
 	}
+
+	void print_usage() {
+		std::cout << "Usage: vehicles [--option value]...\n"
+			"  --build-pack <file>        bake the assets into a pack and exit\n"
+			"  --headless <ticks>         run without a window for the given ticks\n"
+			"  --seed <n>                 seed the random engine\n"
+			"  --record <file>            record the run\n"
+			"  --replay <file>            play back a recording\n"
+			"  --checkpoint <file>        save a checkpoint every 300 ticks\n"
+			"  --resume <file>            start from a checkpoint\n"
+			"  --branches <n>             fork a headless run into seeded branches\n"
+			"  --hash-log <file>          log a state hash after every tick\n"
+			"  --stats <file>             write per tick population statistics\n"
+			"  --metrics-port <port>      serve live metrics over HTTP\n"
+			"  --benchmark <file>         render offscreen and write frame timings\n"
+			"  --benchmark-frames <n>     frames to benchmark, 1920 by default\n"
+			"  --capture <file>           render offscreen into a video file\n"
+			"  --capture-frames <n>       frames to capture, 900 by default\n"
+			"  vehicles --compare-hashes <a> <b>\n"
+			"  vehicles --self-test" << std::endl;
+	}
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+	const char* pack_filename = "assets.pack";
+	const char* record_filename = nullptr;
+	const char* replay_filename = nullptr;
+	const char* checkpoint_filename = nullptr;
+	const char* resume_filename = nullptr;
+	const char* hash_log_filename = nullptr;
+	const char* stats_filename = nullptr;
+	const char* benchmark_filename = nullptr;
+	const char* capture_filename = nullptr;
+	int benchmark_frames = 1920;
+	int capture_frames = 900;
+	bool seeded = false;
+	int headless_ticks = 0;
+	int branch_count = 0;
+	int metrics_port = 0;
+
+	// Reports the first tick two state hash logs disagree on
+	if (argc == 4 && strcmp(argv[1], "--compare-hashes") == 0)
+		return State_Hash_Log::compare(argv[2], argv[3]);
+
+	if (argc == 2 && strcmp(argv[1], "--self-test") == 0)
+		return run_self_test();
+
+	// Every option takes exactly one value, anything else is a mistake worth stopping for rather than a run with the wrong setup
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			std::cout << argv[i] << " needs a value" << std::endl;
+			print_usage();
+			return 1;
+		}
+
+		// Offline step, bakes and bundles the assets then exits without opening a window
+		if (strcmp(argv[i], "--build-pack") == 0)
+			return Simulation::build_asset_pack(argv[i + 1]) ? 0 : 1;
+		else if (strcmp(argv[i], "--record") == 0)
+			record_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--replay") == 0)
+			replay_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--headless") == 0)
+			headless_ticks = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--seed") == 0) {
+			seed_random(static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10)));
+			seeded = true;
+		}
+		else if (strcmp(argv[i], "--checkpoint") == 0)
+			checkpoint_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--resume") == 0)
+			resume_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--branches") == 0)
+			branch_count = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--hash-log") == 0)
+			hash_log_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--stats") == 0)
+			stats_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--metrics-port") == 0)
+			metrics_port = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--benchmark") == 0)
+			benchmark_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--benchmark-frames") == 0)
+			benchmark_frames = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--capture") == 0)
+			capture_filename = argv[i + 1];
+		else if (strcmp(argv[i], "--capture-frames") == 0)
+			capture_frames = atoi(argv[i + 1]);
+		else {
+			std::cout << "Unknown option " << argv[i] << std::endl;
+			print_usage();
+			return 1;
+		}
+	}
+
+	// A replay has no physics world of its own to record
+	if (record_filename != nullptr && replay_filename != nullptr) {
+		std::cout << "--record cannot be combined with --replay" << std::endl;
+		return 1;
+	}
+
+	// A benchmark always renders the same scene, a fixed seed unless one was given or a replay supplies it
+	if (benchmark_filename != nullptr && !seeded)
+		seed_random(1);
+
+	// Runs the given number of ticks as fast as possible, usually with --record so the run can be inspected afterwards
+	if (headless_ticks > 0) {
+		Simulation simulation;
+		if (resume_filename != nullptr && !simulation.load_checkpoint(resume_filename))
+			return 1;
+		if (record_filename != nullptr && !simulation.start_recording(record_filename))
+			return 1;
+		if (checkpoint_filename != nullptr)
+			simulation.checkpoint_filename = checkpoint_filename;
+		if (hash_log_filename != nullptr && !simulation.hash_log.init(hash_log_filename))
+			return 1;
+		if (stats_filename != nullptr && !simulation.stats.init(stats_filename))
+			return 1;
+		if (metrics_port > 0 && !simulation.metrics_server.init(metrics_port, &simulation.metrics))
+			return 1;
+
+		simulation.run_headless(headless_ticks);
+
+		// Forks the final state into differently seeded branches that each run as long again
+		if (branch_count > 0) {
+			std::vector<uint8_t> checkpoint;
+			simulation.checkpoint(checkpoint);
+
+			std::vector<Branch> branches(branch_count);
+			for (int i = 0; i < branch_count; i++)
+				branches[i].seed = i + 1;
+
+			std::vector<Branch_Result> results;
+			Simulation::run_branches(checkpoint, branches, headless_ticks, results);
+
+			for (int i = 0; i < branch_count; i++) {
+				const Branch_Result& r = results[i];
+				std::cout << "Branch " << i << ": tick " << r.tick << ", generation " << r.generation << ", predators/prey " << r.predators << "/" << r.prey
+					<< ", catches " << r.catches << ", mean energy " << r.mean_energy << std::endl;
+			}
+		}
+
+		simulation.destroy();
+		return 0;
+	}
+
+	// Assets are served from the pack when it exists and from loose files otherwise
+	uint64_t pack_size;
+	int64_t pack_time;
+	if (file_stamp(pack_filename, pack_size, pack_time))
+		asset_pack.init(pack_filename);
+
+	// Benchmarks and captures never show anything, so they run without a display server. GLFW's null platform has no windows
+	// to speak of and the context is a surfaceless EGL one, which Mesa backs with llvmpipe on a machine without a GPU
+	bool offscreen = benchmark_filename != nullptr || capture_filename != nullptr;
+	if (offscreen) {
+#ifdef GLFW_PLATFORM_NULL
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+		std::cout << "Offscreen rendering needs GLFW 3.4 or later" << std::endl;
+		return 1;
+#endif
+	}
+
 	// GLFW
 	if (!glfwInit()) {
 		std::cout << "GLFW failed to initialise" << std::endl;
@@ -74,12 +252,14 @@ int main() {
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_DEPTH_BITS, 24);
+	if (offscreen)
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
 
-	GLFWwindow* window = glfwCreateWindow(config::resolution.x, config::resolution.y, "Vehicles", (config::fullscreen) ? glfwGetPrimaryMonitor() : NULL, NULL);
+	GLFWwindow* window = glfwCreateWindow(config::resolution.x, config::resolution.y, "Vehicles", (config::fullscreen && !offscreen) ? glfwGetPrimaryMonitor() : NULL, NULL);
 
 	if (!window) {
 		glfwTerminate();
-		std::cout << "GFLW failed to create window" << std::endl;
+		std::cout << (offscreen ? "GLFW failed to create an offscreen context" : "GFLW failed to create window") << std::endl;
 		return 1;
 	} 
 
@@ -88,9 +268,9 @@ int main() {
 	glfwSetMouseButtonCallback(window, &mouse_button_callback);
 	glfwSetKeyCallback(window, &key_callback);
 		
-	// Glew
+	// Glew, a windowless context has no GLX or WGL display for glewInit to query so only the GL entry points are loaded
 	glewExperimental = GL_TRUE;
-	if (glewInit() != GLEW_OK) {
+	if ((offscreen ? glewContextInit() : glewInit()) != GLEW_OK) {
 		glfwTerminate();
 		std::cout << "Glew failed to initialise" << std::endl;
 		return 1;
@@ -112,11 +292,49 @@ int main() {
 	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
 	glClearColor(0.f, 0.f, 0.f, 0.f);
 	
-	Simulation simulation = Simulation();
+	Simulation simulation;
 	simulation.init();
 
+	// As when headless, an option that cannot be honoured ends the run, each of these reports its own failure
+	bool started =
+		(resume_filename == nullptr || simulation.load_checkpoint(resume_filename)) &&
+		(replay_filename == nullptr || simulation.load_replay(replay_filename)) &&
+		(record_filename == nullptr || simulation.start_recording(record_filename)) &&
+		(hash_log_filename == nullptr || simulation.hash_log.init(hash_log_filename)) &&
+		(stats_filename == nullptr || simulation.stats.init(stats_filename)) &&
+		(metrics_port <= 0 || simulation.metrics_server.init(metrics_port, &simulation.metrics));
+
+	if (!started) {
+		simulation.destroy();
+		glfwTerminate();
+		asset_pack.destroy();
+		return 1;
+	}
+
+	if (checkpoint_filename != nullptr)
+		simulation.checkpoint_filename = checkpoint_filename;
+
 	glfwSetWindowUserPointer(window, &simulation);
 
+	if (benchmark_filename != nullptr) {
+		bool completed = simulation.run_benchmark(benchmark_frames, benchmark_filename);
+
+		simulation.destroy();
+		glfwTerminate();
+		asset_pack.destroy();
+		return completed ? 0 : 1;
+	}
+
+	// Renders into the capture's framebuffer object only, the null platform window is there for its context and never drawn to
+	if (capture_filename != nullptr) {
+		bool completed = simulation.run_capture(capture_frames, capture_filename);
+
+		simulation.destroy();
+		glfwTerminate();
+		asset_pack.destroy();
+		return completed ? 0 : 1;
+	}
+
 	while (!glfwWindowShouldClose(window)) {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -130,5 +348,7 @@ int main() {
 	simulation.destroy();
 	glfwTerminate();
 
+	asset_pack.destroy();
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "..\include\mapped_file.h"
+
+#include <iostream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Mapped_File::Mapped_File() {
+	data = nullptr;
+	size = 0;
+
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	file = -1;
+#endif
+}
+
+Mapped_File::~Mapped_File() {
+	destroy();
+}
+
+Mapped_File::Mapped_File(Mapped_File&& other) : Mapped_File() {
+	*this = std::move(other);
+}
+
+Mapped_File& Mapped_File::operator = (Mapped_File&& other) {
+	if (this == &other)
+		return *this;
+
+	destroy();
+
+	data = other.data;
+	size = other.size;
+	file = other.file;
+#ifdef _WIN32
+	mapping = other.mapping;
+	other.mapping = NULL;
+	other.file = INVALID_HANDLE_VALUE;
+#else
+	other.file = -1;
+#endif
+	other.data = nullptr;
+	other.size = 0;
+
+	return *this;
+}
+
+bool Mapped_File::init(const char* filename) {
+	destroy();
+
+#ifdef _WIN32
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "Failed to open " << filename << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	size = static_cast<size_t>(file_size.QuadPart);
+
+	// Empty files cannot be mapped, leave data null and let the caller see size 0
+	if (size == 0)
+		return true;
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	file = ::open(filename, O_RDONLY);
+	if (file == -1) {
+		std::cout << "Failed to open " << filename << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	fstat(file, &st);
+	size = static_cast<size_t>(st.st_size);
+
+	if (size == 0)
+		return true;
+
+	void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (view != MAP_FAILED)
+		data = static_cast<const char*>(view);
+#endif
+
+	if (data == nullptr) {
+		std::cout << "Failed to map " << filename << std::endl;
+		destroy();
+		return false;
+	}
+
+	return true;
+}
+
+void Mapped_File::destroy() {
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping != NULL)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data != nullptr)
+		munmap(const_cast<char*>(data), size);
+	if (file != -1)
+		::close(file);
+
+	file = -1;
+#endif
+
+	data = nullptr;
+	size = 0;
+}
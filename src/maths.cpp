@@ -37,6 +37,24 @@ namespace maths {
 	}
 
 	mat4 mult(const mat4& a, const mat4& b) {
+#ifdef MATHS_SSE
+		__m128 bx = _mm_loadu_ps(&b.x.x);
+		__m128 by = _mm_loadu_ps(&b.y.x);
+		__m128 bz = _mm_loadu_ps(&b.z.x);
+		__m128 bw = _mm_loadu_ps(&b.w.x);
+
+		mat4 m;
+		for (int i = 0; i < 4; i++) {
+			const vec4& row = a[i];
+			__m128 r = _mm_mul_ps(_mm_set1_ps(row.x), bx);
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row.y), by));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row.z), bz));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row.w), bw));
+			_mm_storeu_ps(&m[i].x, r);
+		}
+
+		return m;
+#else
 		float xx = a.x.x * b.x.x + a.x.y * b.y.x + a.x.z * b.z.x + a.x.w * b.w.x;
 		float xy = a.x.x * b.x.y + a.x.y * b.y.y + a.x.z * b.z.y + a.x.w * b.w.y;
 		float xz = a.x.x * b.x.z + a.x.y * b.y.z + a.x.z * b.z.z + a.x.w * b.w.z;
@@ -63,6 +81,159 @@ namespace maths {
 			{zx, zy, zz, zw},
 			{wx, wy, wz, ww}
 		};
+#endif
+	}
+
+	mat4 model_matrix(const vec3& size, const vec3& position, const vec3& rotation) {
+		// Most transforms only rotate about one axis, so skip the trig for the others
+		float cx = 1.f, sx = 0.f, cy = 1.f, sy = 0.f, cz = 1.f, sz = 0.f;
+		if (rotation.x != 0.f) { float r = rotation.x * (PI / 180.f); cx = cos(r); sx = sin(r); }
+		if (rotation.y != 0.f) { float r = rotation.y * (PI / 180.f); cy = cos(r); sy = sin(r); }
+		if (rotation.z != 0.f) { float r = rotation.z * (PI / 180.f); cz = cos(r); sz = sin(r); }
+
+		// Rows of rotate_z * rotate_y * rotate_x
+		float r00 = cz * cy, r01 = cz * sy * sx - sz * cx, r02 = cz * sy * cx + sz * sx;
+		float r10 = sz * cy, r11 = sz * sy * sx + cz * cx, r12 = sz * sy * cx - cz * sx;
+		float r20 = -sy,     r21 = cy * sx,                r22 = cy * cx;
+
+		mat4 m;
+#ifdef MATHS_SSE
+		_mm_storeu_ps(&m.x.x, _mm_mul_ps(_mm_set1_ps(size.x), _mm_set_ps(0.f, r02, r01, r00)));
+		_mm_storeu_ps(&m.y.x, _mm_mul_ps(_mm_set1_ps(size.y), _mm_set_ps(0.f, r12, r11, r10)));
+		_mm_storeu_ps(&m.z.x, _mm_mul_ps(_mm_set1_ps(size.z), _mm_set_ps(0.f, r22, r21, r20)));
+		_mm_storeu_ps(&m.w.x, _mm_set_ps(1.f, position.z, position.y, position.x));
+#else
+		m.x = vec4{ size.x * r00, size.x * r01, size.x * r02, 0.f };
+		m.y = vec4{ size.y * r10, size.y * r11, size.y * r12, 0.f };
+		m.z = vec4{ size.z * r20, size.z * r21, size.z * r22, 0.f };
+		m.w = vec4{ position, 1.f };
+#endif
+		return m;
+	}
+
+#ifdef MATHS_SSE
+	namespace {
+#ifdef MATHS_AVX
+		typedef __m256 Lanes;
+		const size_t LANE_COUNT = 8;
+
+		inline Lanes lanes_load(const float* p) { return _mm256_loadu_ps(p); }
+		inline Lanes lanes_set(float v) { return _mm256_set1_ps(v); }
+		inline Lanes lanes_add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+		inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+		inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+		inline __m128 lanes_quarter(Lanes a, size_t q) { return (q == 0) ? _mm256_castps256_ps128(a) : _mm256_extractf128_ps(a, 1); }
+#else
+		typedef __m128 Lanes;
+		const size_t LANE_COUNT = 4;
+
+		inline Lanes lanes_load(const float* p) { return _mm_loadu_ps(p); }
+		inline Lanes lanes_set(float v) { return _mm_set1_ps(v); }
+		inline Lanes lanes_add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+		inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+		inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+		inline __m128 lanes_quarter(Lanes a, size_t) { return a; }
+#endif
+
+		// x, y, z and w hold one row component of four matrices, transposed they are that row of each
+		inline void store_row(__m128 x, __m128 y, __m128 z, __m128 w, mat4* out, int row) {
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			_mm_store_ps(&out[0][row].x, x);
+			_mm_store_ps(&out[1][row].x, y);
+			_mm_store_ps(&out[2][row].x, z);
+			_mm_store_ps(&out[3][row].x, w);
+		}
+
+		// Same trig skipping as model_matrix, there is no SIMD sin or cos to hand so each lane gets its own
+		inline void rotation_lanes(const float* degrees, Lanes& c, Lanes& s) {
+			alignas(32) float cs[LANE_COUNT], ss[LANE_COUNT];
+			for (size_t i = 0; i < LANE_COUNT; i++) {
+				float r = degrees[i] * (PI / 180.f);
+				cs[i] = (r != 0.f) ? cos(r) : 1.f;
+				ss[i] = (r != 0.f) ? sin(r) : 0.f;
+			}
+			c = lanes_load(cs);
+			s = lanes_load(ss);
+		}
+	}
+#endif
+
+	void model_matrices(const float* const sizes[3], const float* const positions[3], const float* const rotations[3], size_t count, mat4* out) {
+		size_t i = 0;
+
+#ifdef MATHS_SSE
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+
+		for (; i + LANE_COUNT <= count; i += LANE_COUNT) {
+			Lanes cx, sx, cy, sy, cz, sz;
+			rotation_lanes(rotations[0] + i, cx, sx);
+			rotation_lanes(rotations[1] + i, cy, sy);
+			rotation_lanes(rotations[2] + i, cz, sz);
+
+			// Rows of rotate_z * rotate_y * rotate_x, each scaled by its axis of size
+			Lanes cz_sy = lanes_mul(cz, sy);
+			Lanes sz_sy = lanes_mul(sz, sy);
+
+			Lanes size_x = lanes_load(sizes[0] + i);
+			Lanes r00 = lanes_mul(size_x, lanes_mul(cz, cy));
+			Lanes r01 = lanes_mul(size_x, lanes_sub(lanes_mul(cz_sy, sx), lanes_mul(sz, cx)));
+			Lanes r02 = lanes_mul(size_x, lanes_add(lanes_mul(cz_sy, cx), lanes_mul(sz, sx)));
+
+			Lanes size_y = lanes_load(sizes[1] + i);
+			Lanes r10 = lanes_mul(size_y, lanes_mul(sz, cy));
+			Lanes r11 = lanes_mul(size_y, lanes_add(lanes_mul(sz_sy, sx), lanes_mul(cz, cx)));
+			Lanes r12 = lanes_mul(size_y, lanes_sub(lanes_mul(sz_sy, cx), lanes_mul(cz, sx)));
+
+			Lanes size_z = lanes_load(sizes[2] + i);
+			Lanes r20 = lanes_mul(size_z, lanes_sub(lanes_set(0.f), sy));
+			Lanes r21 = lanes_mul(size_z, lanes_mul(cy, sx));
+			Lanes r22 = lanes_mul(size_z, lanes_mul(cy, cx));
+
+			Lanes px = lanes_load(positions[0] + i);
+			Lanes py = lanes_load(positions[1] + i);
+			Lanes pz = lanes_load(positions[2] + i);
+
+			for (size_t q = 0; q < LANE_COUNT / 4; q++) {
+				mat4* m = out + i + q * 4;
+				store_row(lanes_quarter(r00, q), lanes_quarter(r01, q), lanes_quarter(r02, q), zero, m, 0);
+				store_row(lanes_quarter(r10, q), lanes_quarter(r11, q), lanes_quarter(r12, q), zero, m, 1);
+				store_row(lanes_quarter(r20, q), lanes_quarter(r21, q), lanes_quarter(r22, q), zero, m, 2);
+				store_row(lanes_quarter(px, q), lanes_quarter(py, q), lanes_quarter(pz, q), one, m, 3);
+			}
+		}
+#endif
+
+		// Whatever does not fill a whole set of lanes
+		for (; i < count; i++) {
+			out[i] = model_matrix(vec3{ sizes[0][i], sizes[1][i], sizes[2][i] }, vec3{ positions[0][i], positions[1][i], positions[2][i] },
+				vec3{ rotations[0][i], rotations[1][i], rotations[2][i] });
+		}
+	}
+
+	mat4 normal_matrix(const mat4& m) {
+		vec3 r0 = { m.x.x, m.x.y, m.x.z };
+		vec3 r1 = { m.y.x, m.y.y, m.y.z };
+		vec3 r2 = { m.z.x, m.z.y, m.z.z };
+
+		// Rows of the cofactor matrix, which is the inverse transpose scaled by the determinant
+		vec3 c0 = cross_product(r1, r2);
+		vec3 c1 = cross_product(r2, r0);
+		vec3 c2 = cross_product(r0, r1);
+
+		float det = dot_product(r0, c0);
+		if (det != 0.f) {
+			c0 /= det;
+			c1 /= det;
+			c2 /= det;
+		}
+
+		return mat4{
+			{ c0, 0.f },
+			{ c1, 0.f },
+			{ c2, 0.f },
+			{ 0.f, 0.f, 0.f, 1.f }
+		};
 	}
 
 	bool point_triangle_intersect(const vec2& p, const vec2& a, const vec2& b, const vec2& c) {
@@ -0,0 +1,269 @@
+#include "..\include\metrics.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <windows.h>
+#include <psapi.h>
+
+typedef SOCKET Socket_Handle;
+const Socket_Handle NO_SOCKET = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int Socket_Handle;
+const Socket_Handle NO_SOCKET = -1;
+#define closesocket close
+#endif
+
+const double Metrics::TICK_BUCKET_BOUNDS[Metrics::TICK_BUCKETS - 1] = { 0.00025, 0.0005, 0.001, 0.002, 0.004, 0.008, 0.016, 0.032 };
+
+namespace {
+	const char* PHASE_NAMES[Metrics::PHASE_COUNT] = { "physics", "sensors", "respawn", "output" };
+
+	// A client that hung up mid-response must not raise SIGPIPE and end the process
+#ifdef MSG_NOSIGNAL
+	const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+	const int SEND_FLAGS = 0;
+#endif
+
+	// A client that stops sending or reading gives up after this, so it cannot stall the endpoint or hold up destroy
+	void set_timeouts(Socket_Handle client, int seconds) {
+#ifdef _WIN32
+		// Winsock takes milliseconds as a DWORD, not a timeval
+		DWORD timeout = seconds * 1000;
+#else
+		timeval timeout = { seconds, 0 };
+#endif
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+	}
+
+	uint64_t resident_bytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.WorkingSetSize;
+		return 0;
+#else
+		unsigned long pages = 0, resident = 0;
+		std::ifstream statm("/proc/self/statm");
+		if (!(statm >> pages >> resident))
+			return 0;
+		return static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	void respond(Socket_Handle client, const Metrics* metrics) {
+		char request[1024];
+		int received = recv(client, request, sizeof(request) - 1, 0);
+		if (received <= 0)
+			return;
+		request[received] = '\0';
+
+		std::string body;
+		std::string status;
+		if (strncmp(request, "GET /metrics", 12) == 0) {
+			status = "200 OK";
+			body = metrics->exposition();
+		}
+		else {
+			status = "404 Not Found";
+			body = "Only /metrics is served\n";
+		}
+
+		std::ostringstream response;
+		response << "HTTP/1.1 " << status << "\r\n"
+			<< "Content-Type: text/plain; version=0.0.4\r\n"
+			<< "Content-Length: " << body.size() << "\r\n"
+			<< "Connection: close\r\n\r\n" << body;
+
+		std::string out = response.str();
+		for (size_t sent = 0; sent < out.size();) {
+			int n = send(client, out.data() + sent, static_cast<int>(out.size() - sent), SEND_FLAGS);
+			if (n <= 0)
+				break;
+			sent += n;
+		}
+	}
+
+	void serve(Socket_Handle server, const Metrics* metrics, std::atomic<bool>* stopping) {
+		while (!stopping->load()) {
+			// Wakes regularly to notice destroy, clients are handled one at a time since a scrape is tiny
+			fd_set ready;
+			FD_ZERO(&ready);
+			FD_SET(server, &ready);
+			timeval timeout = { 0, 200000 };
+			if (select(static_cast<int>(server + 1), &ready, nullptr, nullptr, &timeout) <= 0)
+				continue;
+
+			Socket_Handle client = accept(server, nullptr, nullptr);
+			if (client == NO_SOCKET)
+				continue;
+
+			set_timeouts(client, 1);
+			respond(client, metrics);
+			closesocket(client);
+		}
+
+		closesocket(server);
+	}
+}
+
+Metrics::Metrics() : ticks(0), tick_nanoseconds(0), tick_rate(0.f), predators(0), prey(0), respawns(0), catches(0), contacts(0),
+	rate_window_start(std::chrono::steady_clock::now()), rate_window_ticks(0)
+{
+	for (int i = 0; i < TICK_BUCKETS; i++)
+		tick_buckets[i] = 0;
+	for (int i = 0; i < PHASE_COUNT; i++)
+		phase_nanoseconds[i] = 0;
+}
+
+void Metrics::record_phase(Phase phase, std::chrono::steady_clock::duration time) {
+	phase_nanoseconds[phase].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), std::memory_order_relaxed);
+}
+
+void Metrics::record_tick(std::chrono::steady_clock::duration time) {
+	using namespace std::chrono;
+
+	double seconds = duration<double>(time).count();
+	int bucket = 0;
+	while (bucket < TICK_BUCKETS - 1 && seconds > TICK_BUCKET_BOUNDS[bucket])
+		bucket++;
+
+	tick_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	tick_nanoseconds.fetch_add(duration_cast<nanoseconds>(time).count(), std::memory_order_relaxed);
+	ticks.fetch_add(1, std::memory_order_relaxed);
+
+	// Rate over roughly the last second, refreshed once a second
+	rate_window_ticks++;
+	steady_clock::time_point now = steady_clock::now();
+	double window = duration<double>(now - rate_window_start).count();
+	if (window >= 1.0) {
+		tick_rate.store(static_cast<float>(rate_window_ticks / window), std::memory_order_relaxed);
+		rate_window_start = now;
+		rate_window_ticks = 0;
+	}
+}
+
+std::string Metrics::exposition() const {
+	std::ostringstream out;
+
+	out << "# HELP vehicles_ticks_total Simulation ticks stepped.\n# TYPE vehicles_ticks_total counter\n";
+	out << "vehicles_ticks_total " << ticks.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_tick_rate Ticks per second over the last second.\n# TYPE vehicles_tick_rate gauge\n";
+	out << "vehicles_tick_rate " << tick_rate.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_tick_seconds Time spent in each tick.\n# TYPE vehicles_tick_seconds histogram\n";
+	uint64_t cumulative = 0;
+	for (int i = 0; i < TICK_BUCKETS; i++) {
+		cumulative += tick_buckets[i].load(std::memory_order_relaxed);
+		out << "vehicles_tick_seconds_bucket{le=\"";
+		if (i < TICK_BUCKETS - 1)
+			out << TICK_BUCKET_BOUNDS[i];
+		else
+			out << "+Inf";
+		out << "\"} " << cumulative << "\n";
+	}
+	out << "vehicles_tick_seconds_sum " << tick_nanoseconds.load(std::memory_order_relaxed) * 1e-9 << "\n";
+	out << "vehicles_tick_seconds_count " << cumulative << "\n";
+
+	out << "# HELP vehicles_phase_seconds_total Time spent in each phase of a tick.\n# TYPE vehicles_phase_seconds_total counter\n";
+	for (int i = 0; i < PHASE_COUNT; i++)
+		out << "vehicles_phase_seconds_total{phase=\"" << PHASE_NAMES[i] << "\"} " << phase_nanoseconds[i].load(std::memory_order_relaxed) * 1e-9 << "\n";
+
+	out << "# HELP vehicles_population Vehicles alive by type.\n# TYPE vehicles_population gauge\n";
+	out << "vehicles_population{type=\"predator\"} " << predators.load(std::memory_order_relaxed) << "\n";
+	out << "vehicles_population{type=\"prey\"} " << prey.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_respawns_total Vehicles replaced after being caught or running out of energy.\n# TYPE vehicles_respawns_total counter\n";
+	out << "vehicles_respawns_total " << respawns.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_catches_total Prey caught by predators.\n# TYPE vehicles_catches_total counter\n";
+	out << "vehicles_catches_total " << catches.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_box2d_contacts Contacts in the Box2D world.\n# TYPE vehicles_box2d_contacts gauge\n";
+	out << "vehicles_box2d_contacts " << contacts.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP vehicles_resident_memory_bytes Resident memory of the process.\n# TYPE vehicles_resident_memory_bytes gauge\n";
+	out << "vehicles_resident_memory_bytes " << resident_bytes() << "\n";
+
+	return out.str();
+}
+
+Metrics_Server::Metrics_Server() : stopping(false) {
+}
+
+bool Metrics_Server::init(int port, const Metrics* metrics) {
+	destroy();
+
+#ifdef _WIN32
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+		std::cout << "Winsock failed to initialise" << std::endl;
+		return false;
+	}
+#endif
+
+	Socket_Handle server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (server == NO_SOCKET) {
+		std::cout << "Failed to create the metrics socket" << std::endl;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	// On Windows SO_REUSEADDR would let another process take over a port in use, so the port is claimed exclusively there.
+	// Elsewhere SO_REUSEADDR only allows rebinding while the last run's connections sit in TIME_WAIT
+	int option = 1;
+#ifdef _WIN32
+	setsockopt(server, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, reinterpret_cast<const char*>(&option), sizeof(option));
+#else
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&option), sizeof(option));
+#endif
+
+	// Loopback only, the endpoint is for local scrapers and tunnels
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<unsigned short>(port));
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(server, 8) != 0) {
+		std::cout << "Failed to listen for metrics on port " << port << std::endl;
+		closesocket(server);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	stopping = false;
+	listener = std::thread(serve, server, metrics, &stopping);
+	return true;
+}
+
+void Metrics_Server::destroy() {
+	if (!listener.joinable())
+		return;
+
+	stopping = true;
+	listener.join();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
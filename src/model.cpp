@@ -1,214 +1,701 @@
 #include "..\include\model.h"
 
+#include <cstddef>
+#include <cstring>
+
 Model::Model() {
 
 }
 
 void Model::init(const char* filename) {
-	std::vector <std::pair<int, int>> data_ranges = file_preprocess(filename);
-	load_meshes(filename, data_ranges);
+	if (load(filename))
+		upload();
+}
+
+bool Model::load(const char* filename) {
+	if (load_cache(filename))
+		return true;
+
+	load_meshes(filename);
+	if (meshes.empty())
+		return false;
 
 	for (uint32_t i = 0; i < meshes.size(); i++) {
-		glGenVertexArrays(1, &meshes[i].vao);
-		glBindVertexArray(meshes[i].vao);
-
-		glGenBuffers(1, &meshes[i].vbo_vertices);
-		glGenBuffers(1, &meshes[i].vbo_normals);
-		glGenBuffers(1, &meshes[i].vbo_uvs);
-
-		glBindBuffer(GL_ARRAY_BUFFER, meshes[i].vbo_vertices);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * meshes[i].vertices.size(), &meshes[i].vertices[0], GL_DYNAMIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-
-		glBindBuffer(GL_ARRAY_BUFFER, meshes[i].vbo_normals);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * meshes[i].normals.size(), &meshes[i].normals[0], GL_DYNAMIC_DRAW);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-
-		if (!meshes[i].uvs.empty()) {
-			glBindBuffer(GL_ARRAY_BUFFER, meshes[i].vbo_uvs);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * meshes[i].uvs.size(), &meshes[i].uvs[0], GL_DYNAMIC_DRAW);
-			glEnableVertexAttribArray(2);
-			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
-		}
+		optimise_mesh(meshes[i]);
+		pack_mesh(meshes[i]);
+	}
+
+	write_cache(filename);
+
+	for (uint32_t i = 0; i < meshes.size(); i++) {
+		Mesh& mesh = meshes[i];
+		mesh.vertex_source = mesh.packed_vertices.data();
+		mesh.vertex_count = mesh.vertices.size();
+		mesh.index_source = mesh.indices.data();
+		mesh.index_count = static_cast<GLsizei>(mesh.indices.size());
+	}
+
+	return true;
+}
+
+void Model::upload() {
+	for (uint32_t i = 0; i < meshes.size(); i++) {
+		Mesh& mesh = meshes[i];
+		upload_mesh(mesh);
+
+		mesh.vertices = std::vector<vec3>();
+		mesh.normals = std::vector<vec3>();
+		mesh.uvs = std::vector<vec2>();
+		mesh.indices = std::vector<uint32_t>();
+		mesh.packed_vertices = std::vector<char>();
+		mesh.vertex_source = nullptr;
+		mesh.index_source = nullptr;
 	}
 
+	cache_file.destroy();
+}
+
+void Model::upload_mesh(Mesh& mesh) {
+	mesh.vertex_stride = mesh.uvs_included ? sizeof(Packed_Vertex) : offsetof(Packed_Vertex, uv);
+
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+
+	glGenBuffers(1, &mesh.vbo);
+	glGenBuffers(1, &mesh.ebo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertex_stride * mesh.vertex_count, mesh.vertex_source, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, mesh.vertex_stride, (void*)offsetof(Packed_Vertex, position));
+
+	// Shaders still read a vec3, the fourth component is dropped
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, mesh.vertex_stride, (void*)offsetof(Packed_Vertex, normal));
+
+	if (mesh.uvs_included) {
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, mesh.vertex_stride, (void*)offsetof(Packed_Vertex, uv));
+	}
+
+	// Element buffer binding is part of the VAO state
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * mesh.index_count, mesh.index_source, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
 }
 
 void Model::destroy() {
 	for (uint32_t i = 0; i < meshes.size(); i++) {
-		glDeleteBuffers(1, &meshes[i].vbo_vertices);
-		glDeleteBuffers(1, &meshes[i].vbo_normals);
-		glDeleteBuffers(1, &meshes[i].vbo_uvs);
+		glDeleteBuffers(1, &meshes[i].vbo);
+		glDeleteBuffers(1, &meshes[i].ebo);
 		glDeleteVertexArrays(1, &meshes[i].vao);
 	}
 }
 
-void Model::load_meshes(const char* filename, const std::vector<std::pair<int, int>>& data_ranges) {
-	std::string line;
-	std::vector<vec3> vertex_list, normal_list;
-	std::vector<vec2> uv_list;
-	std::ifstream ifs(filename, std::istream::in);
-	bool uvs_included = check_uvs_included(filename);
-
-	int mesh_num = -1;
-	while (std::getline(ifs, line)) {
-		std::istringstream iss(line);
-		std::string type;
-		iss >> type;
-
-		if (type == "v") {
-			float x, y, z;
-			iss >> x >> y >> z;
-			vertex_list.push_back({ x, y, z });
+namespace {
+	const char* skip_spaces(const char* s, const char* end) {
+		while (s < end && (*s == ' ' || *s == '\t'))
+			s++;
+		return s;
+	}
+
+	const char* next_line(const char* s, const char* end) {
+		while (s < end && *s != '\n')
+			s++;
+		return (s < end) ? s + 1 : end;
+	}
+
+	const char* parse_int(const char* s, const char* end, int& out) {
+		bool negative = false;
+		if (s < end && (*s == '-' || *s == '+'))
+			negative = (*s++ == '-');
+
+		int value = 0;
+		while (s < end && *s >= '0' && *s <= '9')
+			value = value * 10 + (*s++ - '0');
+
+		out = negative ? -value : value;
+		return s;
+	}
+
+	// Enough of strtof for the fixed and exponent notation exporters write, without locale lookups
+	const char* parse_float(const char* s, const char* end, float& out) {
+		s = skip_spaces(s, end);
+
+		bool negative = false;
+		if (s < end && (*s == '-' || *s == '+'))
+			negative = (*s++ == '-');
+
+		double value = 0.0;
+		while (s < end && *s >= '0' && *s <= '9')
+			value = value * 10.0 + (*s++ - '0');
+
+		if (s < end && *s == '.') {
+			s++;
+			double scale = 0.1;
+			while (s < end && *s >= '0' && *s <= '9') {
+				value += (*s++ - '0') * scale;
+				scale *= 0.1;
+			}
 		}
-		else if (type == "vn") {
-			float x, y, z;
-			iss >> x >> y >> z;
-			normal_list.push_back({ x, y, z });
+
+		if (s < end && (*s == 'e' || *s == 'E')) {
+			int exponent;
+			s = parse_int(s + 1, end, exponent);
+			value *= pow(10.0, exponent);
+		}
+
+		out = static_cast<float>(negative ? -value : value);
+		return s;
+	}
+
+	// OBJ indices are 1-based, negative ones count back from the end of the list so far
+	int resolve_index(int index, size_t count) {
+		return (index < 0) ? static_cast<int>(count) + index : index - 1;
+	}
+
+	// Inside the list read so far and small enough for its field of the corner key
+	bool index_in_range(int index, size_t count, int key_bits) {
+		return index >= 0 && static_cast<size_t>(index) < count && index < (1 << key_bits) - 1;
+	}
+}
+
+void Model::load_meshes(const char* filename) {
+	Mapped_File file;
+	if (!file.init(filename))
+		return;
+
+	const char* begin = file.data;
+	const char* end = file.data + file.size;
+
+	// Cheap scan over the bytes so every list is reserved once before parsing
+	size_t vertex_count = 0, normal_count = 0, uv_count = 0;
+	std::vector<size_t> face_counts;
+	for (const char* s = begin; s < end; s = next_line(s, end)) {
+		if (s + 1 >= end)
+			break;
+
+		if (s[0] == 'v') {
+			if (s[1] == 'n') normal_count++;
+			else if (s[1] == 't') uv_count++;
+			else vertex_count++;
 		}
-		else if (type == "vt") {
-			float u, v;
-			iss >> u >> v;
-			uv_list.push_back({ u, v });
+		else if (s[0] == 'o' || (s[0] == 'f' && face_counts.empty())) {
+			face_counts.push_back(0);
 		}
-		else if (type == "f") {
-			Mesh& mesh = meshes.back();
-			process_face(line, uvs_included, mesh.vertex_indices, mesh.uv_indices, mesh.normal_indices);
+
+		if (s[0] == 'f')
+			face_counts.back()++;
+	}
+
+	std::vector<vec3> vertex_list, normal_list;
+	std::vector<vec2> uv_list;
+	vertex_list.reserve(vertex_count);
+	normal_list.reserve(normal_count);
+	uv_list.reserve(uv_count);
+
+	int line = 1;
+	for (const char* s = begin; s < end; s = next_line(s, end), line++) {
+		if (s[0] == 'v' && s + 1 < end) {
+			if (s[1] == ' ' || s[1] == '\t') {
+				vec3 v;
+				const char* p = parse_float(s + 1, end, v.x);
+				p = parse_float(p, end, v.y);
+				parse_float(p, end, v.z);
+				vertex_list.push_back(v);
+			}
+			else if (s[1] == 'n') {
+				vec3 n;
+				const char* p = parse_float(s + 2, end, n.x);
+				p = parse_float(p, end, n.y);
+				parse_float(p, end, n.z);
+				normal_list.push_back(n);
+			}
+			else if (s[1] == 't') {
+				vec2 uv;
+				const char* p = parse_float(s + 2, end, uv.x);
+				parse_float(p, end, uv.y);
+				uv_list.push_back({ uv.x, 1.f - uv.y });
+			}
 		}
-		else if (type == "o") {
-			Mesh mesh = Mesh();
-			mesh.uvs_included = uvs_included;
-			meshes.push_back(mesh);
-			mesh_num++;
+		else if (s[0] == 'o' || (s[0] == 'f' && meshes.empty())) {
+			// Faces are mostly triangles, so three corners each covers the common case without regrowing
+			size_t corners = face_counts[meshes.size()] * 3;
+
+			meshes.push_back(Mesh());
+			meshes.back().indices.reserve(corners);
+			corner_lookup.clear();
+		}
+
+		// A corrupt file loads nothing rather than a mesh with faces missing
+		if (s[0] == 'f' && !process_face(s + 1, end, vertex_list, normal_list, uv_list)) {
+			std::cout << "Face index out of range on line " << line << " of " << filename << std::endl;
+			meshes.clear();
+			break;
 		}
 	}
 
-	ifs.close();
+	file.destroy();
+	corner_lookup.clear();
+
+	for (uint32_t i = 0; i < meshes.size(); i++) {
+		if (!meshes[i].uvs_included)
+			meshes[i].uvs.clear();
+	}
 
 #ifdef _DEBUG
 	std::cout << " Mesh Count: " << meshes.size() << std::endl;
 	std::cout << "Vertex List: " << vertex_list.size() << std::endl;
 	std::cout << "Normal List: " << normal_list.size() << std::endl;
 	std::cout << "    UV List: " << uv_list.size() << std::endl;
-#endif
 
 	for (uint32_t i = 0; i < meshes.size(); i++) {
-		for (uint32_t j = 0; j < meshes[i].vertex_indices.size(); j++) {
-			int vert_index = meshes[i].vertex_indices[j];
-			int norm_index = meshes[i].normal_indices[j];
+		std::cout << "     Mesh " << i << ":" << std::endl;
+		std::cout << "Vertices: " << meshes[i].vertices.size() << std::endl;
+		std::cout << " Normals: " << meshes[i].normals.size() << std::endl;
+		std::cout << "     UVs: " << meshes[i].uvs.size() << std::endl;
+		std::cout << " Indices: " << meshes[i].indices.size() << std::endl;
+	}
+#endif
+}
+
+bool Model::process_face(const char* s, const char* end, const std::vector<vec3>& vertex_list, const std::vector<vec3>& normal_list, const std::vector<vec2>& uv_list) {
+	const int max_corners = 16;
+	int vert[max_corners], uv[max_corners], norm[max_corners];
+	int corners = 0;
+
+	// Corners are v, v/t, v//n or v/t/n
+	s = skip_spaces(s, end);
+	while (s < end && *s != '\n' && *s != '\r' && corners < max_corners) {
+		int v = 0, t = 0, n = 0;
+		s = parse_int(s, end, v);
+
+		if (s < end && *s == '/') {
+			s++;
+			if (s < end && *s != '/')
+				s = parse_int(s, end, t);
+
+			if (s < end && *s == '/')
+				s = parse_int(s + 1, end, n);
+		}
+
+		if (v == 0)
+			break;
+
+		vert[corners] = resolve_index(v, vertex_list.size());
+		uv[corners] = (t != 0) ? resolve_index(t, uv_list.size()) : -1;
+		norm[corners] = (n != 0) ? resolve_index(n, normal_list.size()) : -1;
 
-			vec3 vertex = vertex_list[vert_index];
-			vec3 normal = normal_list[norm_index];
+		if (!index_in_range(vert[corners], vertex_list.size(), 22) || (t != 0 && !index_in_range(uv[corners], uv_list.size(), 21)) ||
+			(n != 0 && !index_in_range(norm[corners], normal_list.size(), 21)))
+			return false;
 
-			meshes[i].vertices.push_back(vertex);
-			meshes[i].normals.push_back(normal);
+		corners++;
+
+		s = skip_spaces(s, end);
+	}
+
+	Mesh& mesh = meshes.back();
+
+	// Quads and larger polygons are split into a fan around the first corner
+	for (int i = 1; i + 1 < corners; i++) {
+		int tri[3] = { 0, i, i + 1 };
+
+		vec3 face_normal;
+		if (norm[0] < 0 || norm[i] < 0 || norm[i + 1] < 0) {
+			vec3 a = vertex_list[vert[0]];
+			face_normal = normalise(cross_product(vertex_list[vert[i]] - a, vertex_list[vert[i + 1]] - a));
 		}
 
-		if (meshes[i].uvs_included) {
-			for (uint32_t j = 0; j < meshes[i].uv_indices.size(); j++) {
-				int uv_index = meshes[i].uv_indices[j];
-				vec2 uv = { uv_list[uv_index].x, 1.f - uv_list[uv_index].y };
-				meshes[i].uvs.push_back(uv);
+		for (int j = 0; j < 3; j++) {
+			int c = tri[j];
+
+			// Corners with a generated face normal belong to this face only, so they are never shared
+			uint64_t key = 0;
+			if (norm[c] >= 0) {
+				key = (static_cast<uint64_t>(vert[c]) << 42) | (static_cast<uint64_t>(uv[c] + 1) << 21) | static_cast<uint64_t>(norm[c] + 1);
+
+				std::unordered_map<uint64_t, uint32_t>::iterator it = corner_lookup.find(key);
+				if (it != corner_lookup.end()) {
+					mesh.indices.push_back(it->second);
+					continue;
+				}
 			}
+
+			uint32_t index = static_cast<uint32_t>(mesh.vertices.size());
+			mesh.vertices.push_back(vertex_list[vert[c]]);
+			mesh.normals.push_back((norm[c] >= 0) ? normal_list[norm[c]] : face_normal);
+			mesh.uvs.push_back((uv[c] >= 0) ? uv_list[uv[c]] : vec2{ 0.f, 0.f });
+			mesh.uvs_included |= (uv[c] >= 0);
+			mesh.indices.push_back(index);
+
+			if (norm[c] >= 0)
+				corner_lookup[key] = index;
 		}
+	}
 
-#ifdef _DEBUG
-		std::cout << "     Mesh " << i << ":" << std::endl;
-		std::cout << "Vertices: " << meshes[i].vertices.size() << std::endl;
-		std::cout << " Normals: " << meshes[i].normals.size() << std::endl;
-		std::cout << "     UVs: " << meshes[i].uvs.size() << std::endl;
-#endif
+	return true;
+}
+
+
+namespace {
+	// Forsyth's linear-speed vertex cache optimisation, scores favour vertices recently used and those with few triangles left
+	const int CACHE_SIZE = 32;
+
+	float vertex_score(int cache_position, int remaining) {
+		if (remaining == 0)
+			return -1.f;
+
+		float score = 0.f;
+		if (cache_position >= 3)
+			score = powf(1.f - (cache_position - 3) * (1.f / (CACHE_SIZE - 3)), 1.5f);
+		else if (cache_position >= 0)
+			score = 0.75f;
+
+		return score + 2.f / sqrtf(static_cast<float>(remaining));
+	}
+
+	void optimise_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count) {
+		size_t triangle_count = indices.size() / 3;
+		if (triangle_count == 0)
+			return;
+
+		std::vector<int> remaining(vertex_count, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			remaining[indices[i]]++;
+
+		// Triangles adjacent to each vertex, packed as offsets into one array
+		std::vector<uint32_t> offsets(vertex_count + 1, 0);
+		for (size_t v = 0; v < vertex_count; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+
+		std::vector<uint32_t> adjacency(indices.size());
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+		std::vector<int> cache_position(vertex_count, -1);
+		std::vector<float> score(vertex_count);
+		for (size_t v = 0; v < vertex_count; v++)
+			score[v] = vertex_score(-1, remaining[v]);
+
+		std::vector<float> triangle_score(triangle_count);
+		std::vector<bool> emitted(triangle_count, false);
+		for (size_t t = 0; t < triangle_count; t++)
+			triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+
+		std::vector<uint32_t> cache, next_cache;
+		cache.reserve(CACHE_SIZE + 3);
+		next_cache.reserve(CACHE_SIZE + 3);
+
+		size_t scan = 0;
+		int best = -1;
+
+		while (output.size() < indices.size()) {
+			// Nothing in cache is adjacent to an unemitted triangle, fall back to the next one in order
+			if (best < 0) {
+				while (emitted[scan])
+					scan++;
+				best = static_cast<int>(scan);
+			}
+
+			emitted[best] = true;
+
+			next_cache.clear();
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[best * 3 + k];
+				output.push_back(v);
+				next_cache.push_back(v);
+				remaining[v]--;
+			}
+
+			for (size_t k = 0; k < cache.size(); k++) {
+				uint32_t v = cache[k];
+				if (v != next_cache[0] && v != next_cache[1] && v != next_cache[2])
+					next_cache.push_back(v);
+			}
+
+			// Vertices pushed out of the cache lose their position bonus
+			for (size_t k = CACHE_SIZE; k < next_cache.size(); k++) {
+				cache_position[next_cache[k]] = -1;
+				score[next_cache[k]] = vertex_score(-1, remaining[next_cache[k]]);
+			}
+
+			if (next_cache.size() > static_cast<size_t>(CACHE_SIZE))
+				next_cache.resize(CACHE_SIZE);
+
+			for (size_t k = 0; k < next_cache.size(); k++) {
+				cache_position[next_cache[k]] = static_cast<int>(k);
+				score[next_cache[k]] = vertex_score(static_cast<int>(k), remaining[next_cache[k]]);
+			}
+
+			best = -1;
+			float best_score = -1.f;
+			for (size_t k = 0; k < next_cache.size(); k++) {
+				uint32_t v = next_cache[k];
+				for (uint32_t a = offsets[v]; a < offsets[v + 1]; a++) {
+					uint32_t t = adjacency[a];
+					if (emitted[t])
+						continue;
+
+					triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+					if (triangle_score[t] > best_score) {
+						best_score = triangle_score[t];
+						best = static_cast<int>(t);
+					}
+				}
+			}
+
+			cache.swap(next_cache);
+		}
+
+		indices.swap(output);
 	}
 }
 
-void Model::process_face(std::string& line, bool uvs_included, std::vector<int>& vertex_indices, std::vector<int>& uv_indices, std::vector<int>& normal_indices) {
-	int x_vert, y_vert, z_vert;
-	int x_norm, y_norm, z_norm;
+void Model::optimise_mesh(Mesh& mesh) {
+	optimise_vertex_cache(mesh.indices, mesh.vertices.size());
+
+	// Renumber vertices in first-use order so fetches walk the buffers forwards
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<vec3> vertices, normals;
+	std::vector<vec2> uvs;
+	vertices.reserve(mesh.vertices.size());
+	normals.reserve(mesh.normals.size());
+	uvs.reserve(mesh.uvs.size());
+
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		uint32_t& index = mesh.indices[i];
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh.vertices[index]);
+			normals.push_back(mesh.normals[index]);
+			if (mesh.uvs_included)
+				uvs.push_back(mesh.uvs[index]);
+		}
 
-	const char* s = line.c_str();
+		index = remap[index];
+	}
 
-	if (uvs_included) {
-		int x_uv, y_uv, z_uv;
+	mesh.vertices.swap(vertices);
+	mesh.normals.swap(normals);
+	mesh.uvs.swap(uvs);
+}
 
-		sscanf_s(s, "f %d/%d/%d %d/%d/%d %d/%d/%d", &x_vert, &x_uv, &x_norm, &y_vert, &y_uv, &y_norm, &z_vert, &z_uv, &z_norm);
+namespace {
+	int32_t pack_snorm10(float v) {
+		v = (v < -1.f) ? -1.f : (v > 1.f) ? 1.f : v;
+		return static_cast<int32_t>(roundf(v * 511.f)) & 0x3FF;
+	}
 
-		uv_indices.push_back(--x_uv);
-		uv_indices.push_back(--y_uv);
-		uv_indices.push_back(--z_uv);
+	uint32_t pack_normal(const vec3& n) {
+		return static_cast<uint32_t>(pack_snorm10(n.x) | (pack_snorm10(n.y) << 10) | (pack_snorm10(n.z) << 20));
 	}
-	else {
-		sscanf_s(s, "f %d//%d %d//%d %d//%d", &x_vert, &x_norm, &y_vert, &y_norm, &z_vert, &z_norm);
+}
+
+uint16_t pack_half(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	// NaNs keep a mantissa bit so they do not turn into infinities
+	if (((bits >> 23) & 0xFF) == 0xFF)
+		return static_cast<uint16_t>(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0));
+
+	if (exponent >= 31)
+		return static_cast<uint16_t>(sign | 0x7C00);
+
+	uint32_t shift = 13;
+	if (exponent <= 0) {
+		// Below half of the smallest subnormal, float subnormals included
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+
+		// Subnormal half, shift the implicit bit in
+		mantissa |= 0x800000;
+		shift = static_cast<uint32_t>(14 - exponent);
+		exponent = 0;
 	}
 
-	vertex_indices.push_back(--x_vert);
-	vertex_indices.push_back(--y_vert);
-	vertex_indices.push_back(--z_vert);
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> shift);
 
-	normal_indices.push_back(--x_norm);
-	normal_indices.push_back(--y_norm);
-	normal_indices.push_back(--z_norm);
+	// A carry out of the mantissa steps the exponent, the largest finite half rounds up to infinity
+	uint32_t rest = mantissa & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1)))
+		half++;
+	return static_cast<uint16_t>(half);
 }
 
-bool Model::check_uvs_included(const char* filename) {
-	std::string line;
-	std::ifstream ifs(filename, std::istream::in);
+void Model::pack_mesh(Mesh& mesh) {
+	size_t stride = mesh.uvs_included ? sizeof(Packed_Vertex) : offsetof(Packed_Vertex, uv);
+	mesh.packed_vertices.resize(stride * mesh.vertices.size());
 
-	size_t pos;
-	bool b = false;
-	while (std::getline(ifs, line)) {
-		pos = line.find('f');
-		if (pos != std::string::npos && pos == 0) {
-			char last = '1';
-			for (uint32_t i = 0; i < line.length(); i++) {
-				char c = line.at(i);
-				if (c == '/' && last == '/')
-					return false;
-				else
-					last = c;
-			}
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		Packed_Vertex v;
+		v.position = mesh.vertices[i];
+		v.normal = pack_normal(mesh.normals[i]);
 
-			return true;
+		if (mesh.uvs_included) {
+			v.uv[0] = pack_half(mesh.uvs[i].x);
+			v.uv[1] = pack_half(mesh.uvs[i].y);
 		}
+
+		memcpy(&mesh.packed_vertices[stride * i], &v, stride);
+	}
+}
+
+namespace {
+	const char MESH_CACHE_MAGIC[4] = { 'G', 'L', 'V', 'M' };
+
+	// Raised whenever Packed_Vertex or the way it is packed changes, so older caches are rebuilt rather than misread
+	const uint32_t MESH_CACHE_VERSION = 3;
+
+	struct Mesh_Cache_Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t source_size;
+		int64_t source_time;
+		uint32_t mesh_count;
+		uint32_t padding;
+	};
+
+	struct Mesh_Cache_Entry {
+		uint32_t vertex_count;
+		uint32_t index_count;
+		uint32_t uvs_included;
+		uint32_t padding;
+	};
+
+	std::string cache_filename(const char* filename) {
+		return std::string(filename) + ".cache";
 	}
 
-	ifs.close();
-	return b;
 }
 
+bool Model::load_cache(const char* filename) {
+	std::string cache_name = cache_filename(filename);
+	Mapped_File& file = cache_file;
+
+	// The asset pack only returns a cache whose source is unchanged since the pack was built
+	const char* data;
+	size_t size;
+	bool packed = asset_pack.find(cache_name, data, size);
 
-std::vector<std::pair<int, int>> Model::file_preprocess(const char* filename) {
-	std::vector<int> data_ranges;
+	uint64_t source_size;
+	int64_t source_time;
+	if (!packed) {
+		if (!file_stamp(filename, source_size, source_time))
+			return false;
 
-	int current_line_number = 0;
-	std::string line;
-	std::ifstream ifs(filename, std::istream::in);
-	while (std::getline(ifs, line)) {
-		current_line_number++;
+		// A missing cache is the normal first run, so check before mapping to keep the log quiet
+		struct stat st;
+		if (stat(cache_name.c_str(), &st) != 0)
+			return false;
 
-		if (line.front() == 'o')
-			data_ranges.push_back(current_line_number);
+		if (!file.init(cache_name.c_str()))
+			return false;
+
+		data = file.data;
+		size = file.size;
 	}
-	ifs.close();
 
-	int linecount = utils::line_count(filename);
-	std::vector <std::pair<int, int>> begin_end_markers;
-	for (uint32_t i = 0; i < data_ranges.size(); i++) {
-		std::pair<int, int> marker;
+	const char* p = data;
+	const char* end = data + size;
 
-		if (i == 0)
-			marker.first = 3;
-		else
-			marker.first = data_ranges[i];
+	const Mesh_Cache_Header* header = reinterpret_cast<const Mesh_Cache_Header*>(p);
+	if (size < sizeof(Mesh_Cache_Header) || memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION ||
+		(!packed && (header->source_size != source_size || header->source_time != source_time))) {
+		file.destroy();
+		return false;
+	}
 
-		if (i == data_ranges.size() - 1)
-			marker.second = linecount - 1;
-		else
-			marker.second = data_ranges[i + 1] - 2;
+	p += sizeof(Mesh_Cache_Header);
+
+	// Validate every entry fits and indexes only its own vertices before handing out pointers into the mapping, a damaged cache
+	// would otherwise have the GPU read past the vertex buffer
+	const char* q = p;
+	for (uint32_t i = 0; i < header->mesh_count; i++) {
+		bool fits = static_cast<size_t>(end - q) >= sizeof(Mesh_Cache_Entry);
+		if (fits) {
+			const Mesh_Cache_Entry* entry = reinterpret_cast<const Mesh_Cache_Entry*>(q);
+			size_t vertex_bytes = static_cast<size_t>(entry->vertex_count) * (entry->uvs_included ? sizeof(Packed_Vertex) : offsetof(Packed_Vertex, uv));
+			size_t index_bytes = static_cast<size_t>(entry->index_count) * sizeof(uint32_t);
+			q += sizeof(Mesh_Cache_Entry);
+			fits = static_cast<size_t>(end - q) >= vertex_bytes && static_cast<size_t>(end - q) - vertex_bytes >= index_bytes;
+
+			if (fits) {
+				const uint32_t* indices = reinterpret_cast<const uint32_t*>(q + vertex_bytes);
+				for (uint32_t j = 0; fits && j < entry->index_count; j++)
+					fits = indices[j] < entry->vertex_count;
+				q += vertex_bytes + index_bytes;
+			}
+		}
+
+		if (!fits) {
+			file.destroy();
+			return false;
+		}
+	}
 
-		begin_end_markers.push_back(marker);
+	meshes.resize(header->mesh_count);
+	for (uint32_t i = 0; i < header->mesh_count; i++) {
+		const Mesh_Cache_Entry* entry = reinterpret_cast<const Mesh_Cache_Entry*>(p);
+		p += sizeof(Mesh_Cache_Entry);
+
+		const char* vertices = p;
+		p += (entry->uvs_included ? sizeof(Packed_Vertex) : offsetof(Packed_Vertex, uv)) * entry->vertex_count;
+
+		const uint32_t* indices = reinterpret_cast<const uint32_t*>(p);
+		p += sizeof(uint32_t) * entry->index_count;
+
+		meshes[i].uvs_included = entry->uvs_included != 0;
+		meshes[i].vertex_source = vertices;
+		meshes[i].vertex_count = entry->vertex_count;
+		meshes[i].index_source = indices;
+		meshes[i].index_count = static_cast<GLsizei>(entry->index_count);
 	}
 
-	return begin_end_markers;
-}
\ No newline at end of file
+	return true;
+}
+
+void Model::write_cache(const char* filename) {
+	Mesh_Cache_Header header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+	header.version = MESH_CACHE_VERSION;
+	header.mesh_count = static_cast<uint32_t>(meshes.size());
+	if (!file_stamp(filename, header.source_size, header.source_time))
+		return;
+
+	std::string cache_name = cache_filename(filename);
+	std::ofstream ofs(temp_filename(cache_name.c_str()).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to write " << cache_name << std::endl;
+		return;
+	}
+
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (uint32_t i = 0; i < meshes.size(); i++) {
+		const Mesh& mesh = meshes[i];
+
+		Mesh_Cache_Entry entry = {};
+		entry.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+		entry.index_count = static_cast<uint32_t>(mesh.indices.size());
+		entry.uvs_included = mesh.uvs_included ? 1 : 0;
+
+		ofs.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		ofs.write(mesh.packed_vertices.data(), mesh.packed_vertices.size());
+		ofs.write(reinterpret_cast<const char*>(mesh.indices.data()), sizeof(uint32_t) * mesh.indices.size());
+	}
+
+	commit_file(ofs, cache_name.c_str());
+}
@@ -0,0 +1,51 @@
+#include "..\include\offscreen_target.h"
+
+#include <iostream>
+
+Offscreen_Target::Offscreen_Target() : width(0), height(0), framebuffer(0), colour_buffer(0), depth_buffer(0) {
+}
+
+bool Offscreen_Target::init(int width, int height) {
+	destroy();
+
+	this->width = width;
+	this->height = height;
+
+	glGenRenderbuffers(1, &colour_buffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colour_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &depth_buffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (!complete) {
+		std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+		destroy();
+		return false;
+	}
+
+	return true;
+}
+
+void Offscreen_Target::destroy() {
+	if (framebuffer != 0) {
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &colour_buffer);
+		glDeleteRenderbuffers(1, &depth_buffer);
+		framebuffer = colour_buffer = depth_buffer = 0;
+	}
+}
+
+void Offscreen_Target::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+}
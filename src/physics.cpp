@@ -1,6 +1,23 @@
 #include "..\include\physics.h"
 
-set<pair<VehicleData*, VehicleData*>> vehicle_collision_events;
+namespace {
+	void save_body(Checkpoint_Writer& w, const b2Body* body) {
+		w.write(body->GetPosition());
+		w.write(body->GetAngle());
+		w.write(body->GetLinearVelocity());
+		w.write(body->GetAngularVelocity());
+		w.write(body->IsAwake());
+	}
+
+	void restore_body(Checkpoint_Reader& r, b2Body* body) {
+		b2Vec2 position = r.read<b2Vec2>();
+		float angle = r.read<float>();
+		body->SetTransform(position, angle);
+		body->SetLinearVelocity(r.read<b2Vec2>());
+		body->SetAngularVelocity(r.read<float>());
+		body->SetAwake(r.read<bool>());
+	}
+}
 
 Boundary::Boundary(b2World* world, const b2Vec2& position, float angle) {
 	polygon_shape.SetAsBox(4.f, 800.f);
@@ -21,7 +38,8 @@ void Boundary::destroy() {
 }
 
 Tyre::Tyre(b2World* world, float max_forward_speed, float max_backward_speed, float max_drive_force, float max_lateral_impulse) 
-	: max_forward_speed(max_forward_speed), max_backward_speed(max_backward_speed), max_drive_force(max_drive_force), max_lateral_impulse(max_lateral_impulse) 
+	: max_forward_speed(max_forward_speed), max_backward_speed(max_backward_speed), max_drive_force(max_drive_force), max_lateral_impulse(max_lateral_impulse),
+	pending_force(0.f, 0.f)
 {
 	b2BodyDef body_def;
 	body_def.type = b2_dynamicBody;
@@ -68,6 +86,10 @@ void Tyre::update_friction() {
 	float forward_speed = forward_normal.Normalize();
 	float drag_magnitude = -2 * forward_speed;
 	body->ApplyForce(drag_magnitude * forward_normal, body->GetWorldCenter(), true);
+
+	// The step just taken cleared the body's forces, this one starts them again
+	pending_force.SetZero();
+	pending_force += drag_magnitude * forward_normal;
 }
 
 void Tyre::update_drive(float desired_speed) {
@@ -90,11 +112,13 @@ void Tyre::update_drive(float desired_speed) {
 		return;
 
 	body->ApplyForce(force * forward_normal, body->GetWorldCenter(), true);
+	pending_force += force * forward_normal;
 }
 
 Vehicle::Vehicle() {
 	desired_angle = 0; // 70
 	desired_speed = 0; // 100
+	new_angle = 0;
 }
 
 void Vehicle::destroy() {
@@ -109,6 +133,20 @@ void Vehicle::destroy() {
 
 
 void Vehicle::init(b2World* world, b2Vec2 position, float rotation, bool is_predator, int index) {
+	float max_forward_speed = utils::gen_random(50.f, 450.f);
+	float max_backward_speed = -utils::gen_random(50.f, 450.f);
+	float back_tyre_max_drive_force = utils::gen_random(100.f, 400.f);
+	float front_tyre_max_drive_force = utils::gen_random(100.f, 400.f);
+	float back_tyre_max_lateral_impulse = utils::gen_random(10.f, 60.f);
+	float front_tyre_max_lateral_impulse = utils::gen_random(10.f, 60.f);
+
+	build(world, position, is_predator, index, max_forward_speed, max_backward_speed, 
+		back_tyre_max_drive_force, front_tyre_max_drive_force, back_tyre_max_lateral_impulse, front_tyre_max_lateral_impulse);
+}
+
+void Vehicle::build(b2World* world, b2Vec2 position, bool is_predator, int index, float max_forward_speed, float max_backward_speed,
+	float back_tyre_max_drive_force, float front_tyre_max_drive_force, float back_tyre_max_lateral_impulse, float front_tyre_max_lateral_impulse) 
+{
 	this->is_predator = is_predator;
 
 	b2BodyDef body_def;
@@ -139,13 +177,6 @@ void Vehicle::init(b2World* world, b2Vec2 position, float rotation, bool is_pred
 	joint_def.upperAngle = 0;
 	joint_def.localAnchorB.SetZero();
 
-	float max_forward_speed = utils::gen_random(50.f, 450.f);
-	float max_backward_speed = -utils::gen_random(50.f, 450.f);
-	float back_tyre_max_drive_force = utils::gen_random(100.f, 400.f);
-	float front_tyre_max_drive_force = utils::gen_random(100.f, 400.f);
-	float back_tyre_max_lateral_impulse = utils::gen_random(10.f, 60.f);
-	float front_tyre_max_lateral_impulse = utils::gen_random(10.f, 60.f);
-
 	// Back Left
 	Tyre* tyre = new Tyre(world, max_forward_speed, max_backward_speed, back_tyre_max_drive_force, back_tyre_max_lateral_impulse);
 	joint_def.bodyB = tyre->body;
@@ -193,7 +224,67 @@ void Vehicle::update() {
 	fr_joint->SetLimits(new_angle, new_angle);
 }
 
+void Vehicle::save(Checkpoint_Writer& w) const {
+	w.write(is_predator);
+	w.write(desired_angle);
+	w.write(desired_speed);
+	w.write(new_angle);
+
+	// Back tyres come first, each pair shares its limits
+	w.write(tyres[0]->max_forward_speed);
+	w.write(tyres[0]->max_backward_speed);
+	w.write(tyres[0]->max_drive_force);
+	w.write(tyres[2]->max_drive_force);
+	w.write(tyres[0]->max_lateral_impulse);
+	w.write(tyres[2]->max_lateral_impulse);
+
+	w.write(fl_joint->GetLowerLimit());
+	w.write(fr_joint->GetLowerLimit());
+
+	save_body(w, body);
+	for (size_t i = 0; i < tyres.size(); i++)
+		save_body(w, tyres[i]->body);
+
+	// Forces from the last update wait in the world for the next step, Box2D has no getter for them
+	for (size_t i = 0; i < tyres.size(); i++)
+		w.write(tyres[i]->pending_force);
+}
+
+void Vehicle::restore(b2World* world, Checkpoint_Reader& r, int index) {
+	bool predator = r.read<bool>();
+	desired_angle = r.read<float>();
+	desired_speed = r.read<float>();
+	new_angle = r.read<float>();
+
+	float max_forward_speed = r.read<float>();
+	float max_backward_speed = r.read<float>();
+	float back_tyre_max_drive_force = r.read<float>();
+	float front_tyre_max_drive_force = r.read<float>();
+	float back_tyre_max_lateral_impulse = r.read<float>();
+	float front_tyre_max_lateral_impulse = r.read<float>();
+
+	build(world, b2Vec2(0.f, 0.f), predator, index, max_forward_speed, max_backward_speed,
+		back_tyre_max_drive_force, front_tyre_max_drive_force, back_tyre_max_lateral_impulse, front_tyre_max_lateral_impulse);
+
+	// Limits wake their bodies, so they go before the bodies' own awake state
+	float fl_angle = r.read<float>();
+	float fr_angle = r.read<float>();
+	fl_joint->SetLimits(fl_angle, fl_angle);
+	fr_joint->SetLimits(fr_angle, fr_angle);
+
+	restore_body(r, body);
+	for (size_t i = 0; i < tyres.size(); i++)
+		restore_body(r, tyres[i]->body);
+
+	// Summed in the order they were applied, so the body ends up holding the same force, a sleeping body holds none
+	for (size_t i = 0; i < tyres.size(); i++) {
+		tyres[i]->pending_force = r.read<b2Vec2>();
+		tyres[i]->body->ApplyForce(tyres[i]->pending_force, tyres[i]->body->GetWorldCenter(), false);
+	}
+}
+
 void ContactListener::BeginContact(b2Contact* contact) {
+	begin_contacts++;
 
 	b2Filter fA = contact->GetFixtureA()->GetFilterData();
 	b2Filter fB = contact->GetFixtureB()->GetFilterData();
@@ -203,7 +294,7 @@ void ContactListener::BeginContact(b2Contact* contact) {
 		VehicleData* dA = (VehicleData*)contact->GetFixtureA()->GetUserData(); 
 		VehicleData* dB = (VehicleData*)contact->GetFixtureB()->GetUserData();
 
-		vehicle_collision_events.insert(pair<VehicleData*, VehicleData*>(dA, dB));
+		collision_events->insert(pair<VehicleData, VehicleData>(*dA, *dB));
 	}
 		
 }
@@ -211,6 +302,7 @@ void ContactListener::BeginContact(b2Contact* contact) {
 Physics::Physics(int num_vehicles, std::map<int, Transform>& transforms, std::map<int, Vehicle_Attributes>& v_attribs)
 	: gravity{ 0.f, 0.f }, world(gravity), velocity_iterations(12), position_iterations(12), time_step(1.f / 30.f) 
 {
+	profile = Physics_Profile();
 	vehicles = map<int, Vehicle>();
 	for (int i = 0; i < num_vehicles; i++)
 		vehicles[i].init(&world, { transforms[i].position.x, transforms[i].position.z }, transforms[i].rotation.y, v_attribs[i].is_predator, i);
@@ -221,6 +313,7 @@ Physics::Physics(int num_vehicles, std::map<int, Transform>& transforms, std::ma
 	wall_3 = new Boundary{ &world, b2Vec2{ 0.f, -390.f }, 90.f };
 	wall_4 = new Boundary{ &world, b2Vec2{ 0.f,  390.f }, 90.f };
 	
+	vehicle_contact_listener.collision_events = &collision_events;
 	world.SetContactListener(&vehicle_contact_listener);
 
 	for (int i = 0; i < vehicles.size(); i++)
@@ -230,10 +323,31 @@ Physics::Physics(int num_vehicles, std::map<int, Transform>& transforms, std::ma
 }
 
 void Physics::update() {
+	vehicle_contact_listener.begin_contacts = 0;
 	world.Step(time_step, velocity_iterations, position_iterations);
-
 	for (map<int, Vehicle>::iterator it = vehicles.begin(); it != vehicles.end(); ++it)
 		it->second.update();
+
+	const b2Profile& p = world.GetProfile();
+	profile.step = p.step;
+	profile.collide = p.collide;
+	profile.solve = p.solve;
+	profile.solve_toi = p.solveTOI;
+	profile.broadphase = p.broadphase;
+
+	profile.bodies = world.GetBodyCount();
+	profile.contacts = world.GetContactCount();
+	profile.joints = world.GetJointCount();
+	profile.begin_contacts = vehicle_contact_listener.begin_contacts;
+
+	// Box2D keeps no running count of these, both lists are short enough to walk every step
+	profile.awake_bodies = 0;
+	for (b2Body* b = world.GetBodyList(); b != nullptr; b = b->GetNext())
+		profile.awake_bodies += b->IsAwake() ? 1 : 0;
+
+	profile.touching_contacts = 0;
+	for (b2Contact* c = world.GetContactList(); c != nullptr; c = c->GetNext())
+		profile.touching_contacts += c->IsTouching() ? 1 : 0;
 }
 
 vec2 Physics::get_vehicle_position(int index) {
@@ -261,6 +375,27 @@ void Physics::add_vehicle(int instance_id, const Transform& transform, bool is_p
 	vehicles.insert(pair<int, Vehicle>(instance_id, v));
 }
 
+void Physics::save(Checkpoint_Writer& w) const {
+	// Saved in creation order, which id order matches, so a restore rebuilds Box2D's body and joint lists in the same order
+	w.write(static_cast<uint32_t>(vehicles.size()));
+	for (map<int, Vehicle>::const_iterator it = vehicles.begin(); it != vehicles.end(); ++it) {
+		w.write(it->first);
+		it->second.save(w);
+	}
+}
+
+bool Physics::restore(Checkpoint_Reader& r) {
+	uint32_t count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && r.ok; i++) {
+		int instance_id = r.read<int>();
+		Vehicle v;
+		v.restore(&world, r, instance_id);
+		vehicles.insert(pair<int, Vehicle>(instance_id, v));
+	}
+
+	return r.ok;
+}
+
 void Physics::remove_vehicle() {
 	(--vehicles.end())->second.destroy();
 	vehicles.erase(--vehicles.end());
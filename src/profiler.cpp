@@ -0,0 +1,159 @@
+#include "..\include\profiler.h"
+
+#include <algorithm>
+
+namespace {
+	// Weight of the newest frame in the smoothed bars
+	const float SMOOTHING = 0.1f;
+
+	float smooth(float previous, float value) {
+		return previous + (value - previous) * SMOOTHING;
+	}
+}
+
+const char* Profiler::PASS_NAMES[Profiler::PASS_COUNT] = { "Walls", "Bounds", "Bodies", "Wheels", "Sensors", "UI" };
+const char* Profiler::PHASE_NAMES[Metrics::PHASE_COUNT] = { "Physics", "Sensors", "Respawn", "Output" };
+
+Rolling_Samples::Rolling_Samples(size_t capacity) : next(0) {
+	samples.reserve(capacity);
+}
+
+void Rolling_Samples::add(float value) {
+	if (samples.size() < samples.capacity()) {
+		samples.push_back(value);
+	}
+	else {
+		samples[next] = value;
+		next = (next + 1) % samples.size();
+	}
+}
+
+float Rolling_Samples::percentile(float p) const {
+	if (samples.empty())
+		return 0.f;
+
+	std::vector<float> sorted = samples;
+	size_t index = std::min(static_cast<size_t>(p * sorted.size()), sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
+bool Rolling_Samples::empty() const {
+	return samples.empty();
+}
+
+Profiler::Profiler() : gpu_ms(0.f), gpu_sample_ready(false), draw_calls(0), triangles(0), last_ticks(0), last_tick_nanoseconds(0), gpu_frame(0), has_queries(false) {
+	for (int i = 0; i < Metrics::PHASE_COUNT; i++) {
+		phase_ms[i] = 0.f;
+		last_phase_nanoseconds[i] = 0;
+	}
+	for (int i = 0; i < PASS_COUNT; i++) {
+		pass_ms[i] = 0.f;
+		gpu_pass_ms[i] = 0.f;
+		gpu_pass_sample[i] = 0.f;
+	}
+	for (int f = 0; f < GPU_QUERY_FRAMES; f++)
+		for (int i = 0; i < PASS_COUNT; i++)
+			gpu_issued[f][i] = false;
+
+	last_frame = Clock::now();
+}
+
+void Profiler::init() {
+	glGenQueries(GPU_QUERY_FRAMES * PASS_COUNT, &gpu_queries[0][0]);
+	has_queries = true;
+	gpu_frame = 0;
+}
+
+void Profiler::destroy() {
+	if (has_queries)
+		glDeleteQueries(GPU_QUERY_FRAMES * PASS_COUNT, &gpu_queries[0][0]);
+	has_queries = false;
+}
+
+void Profiler::begin_frame() {
+	int slot = gpu_frame % GPU_QUERY_FRAMES;
+	for (int i = 0; i < PASS_COUNT; i++)
+		gpu_issued[slot][i] = false;
+}
+
+void Profiler::begin_pass(Render_Pass pass) {
+	// Time elapsed queries cannot nest, so passes must not overlap
+	if (has_queries) {
+		int slot = gpu_frame % GPU_QUERY_FRAMES;
+		glBeginQuery(GL_TIME_ELAPSED, gpu_queries[slot][pass]);
+		gpu_issued[slot][pass] = true;
+	}
+
+	pass_start = Clock::now();
+}
+
+void Profiler::end_pass(Render_Pass pass) {
+	float ms = std::chrono::duration<float, std::milli>(Clock::now() - pass_start).count();
+	pass_ms[pass] = smooth(pass_ms[pass], ms);
+
+	if (has_queries)
+		glEndQuery(GL_TIME_ELAPSED);
+}
+
+void Profiler::end_frame(const Metrics& metrics) {
+	Clock::time_point now = Clock::now();
+	frame_ms.add(std::chrono::duration<float, std::milli>(now - last_frame).count());
+	last_frame = now;
+
+	// Ticks stepped since the previous frame, none while paused
+	uint64_t ticks = metrics.ticks.load(std::memory_order_relaxed);
+	uint64_t tick_nanoseconds = metrics.tick_nanoseconds.load(std::memory_order_relaxed);
+	if (ticks > last_ticks)
+		tick_ms.add((tick_nanoseconds - last_tick_nanoseconds) * 1e-6f / (ticks - last_ticks));
+	last_ticks = ticks;
+	last_tick_nanoseconds = tick_nanoseconds;
+
+	for (int i = 0; i < Metrics::PHASE_COUNT; i++) {
+		uint64_t nanoseconds = metrics.phase_nanoseconds[i].load(std::memory_order_relaxed);
+		phase_ms[i] = smooth(phase_ms[i], (nanoseconds - last_phase_nanoseconds[i]) * 1e-6f);
+		last_phase_nanoseconds[i] = nanoseconds;
+	}
+
+	draw_calls = draw_counters.draw_calls;
+	triangles = draw_counters.triangles;
+	draw_counters = Draw_Counters();
+
+	gpu_sample_ready = false;
+	if (!has_queries)
+		return;
+
+	// The slot about to be reused was issued GPU_QUERY_FRAMES - 1 frames ago, a frame still running there is dropped rather than waited on
+	gpu_frame++;
+	int slot = gpu_frame % GPU_QUERY_FRAMES;
+
+	bool ready = false;
+	for (int i = 0; i < PASS_COUNT; i++) {
+		if (!gpu_issued[slot][i]) {
+			gpu_pass_sample[i] = 0.f;
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(gpu_queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			ready = false;
+			break;
+		}
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(gpu_queries[slot][i], GL_QUERY_RESULT, &nanoseconds);
+		gpu_pass_sample[i] = nanoseconds * 1e-6f;
+		ready = true;
+	}
+
+	if (!ready)
+		return;
+
+	gpu_ms = 0.f;
+	for (int i = 0; i < PASS_COUNT; i++) {
+		gpu_pass_ms[i] = smooth(gpu_pass_ms[i], gpu_pass_sample[i]);
+		gpu_ms += gpu_pass_ms[i];
+	}
+	gpu_sample_ready = true;
+}
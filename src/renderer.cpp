@@ -1,5 +1,10 @@
 #include "..\include\renderer.h"
 
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+Draw_Counters draw_counters = {};
+
 void Circle_Renderer::init() {
 	shader_2D = {
 		"shaders/v.uniform_MP.glsl",
@@ -40,6 +45,7 @@ void Circle_Renderer::draw_2D(const Camera& camera, const vec2& position, const
 	shader_2D.set_uniform("draw_filled", filled);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_2D.release();
@@ -56,6 +62,7 @@ void Circle_Renderer::draw_3D(const Camera& camera, const Transform& transform,
 	shader_3D.set_uniform("draw_filled", filled);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_3D.release();
@@ -70,6 +77,7 @@ void Circle_Renderer::draw_3D_shadow(const Camera& camera, const Transform& tran
 	shader_3D_shadow.set_uniform("model", utils::gen_model_matrix(transform));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_3D_shadow.release();
@@ -85,6 +93,7 @@ void Circle_Renderer::draw_multiple_3D_shadow(const Camera& camera, const std::v
 	for (uint32_t i = 0; i < transform_list.size(); i++) {
 		shader_3D_shadow.set_uniform("model", utils::gen_model_matrix(transform_list[i]));
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		count_draw(GL_TRIANGLE_STRIP, 4);
 	}
 
 	glBindVertexArray(0);
@@ -131,6 +140,7 @@ void Triangle_Renderer::draw_3D_coloured(const Camera& camera, const vec3& a, co
 	shader_3D_coloured.set_uniform("model", mat4());
 
 	glDrawArrays(GL_TRIANGLES, 0, 3);
+	count_draw(GL_TRIANGLES, 3);
 
 	glBindVertexArray(0);
 	shader_3D_coloured.release();
@@ -181,6 +191,7 @@ void Quad_Renderer::draw_2D(const Camera& camera, const vec2& position, const ve
 	shader_2D.set_uniform("model", utils::gen_model_matrix(size, position));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_2D.release();
@@ -196,6 +207,7 @@ void Quad_Renderer::draw_3D_coloured(const Camera& camera, const Transform& tran
 	shader_3D_coloured.set_uniform("model", utils::gen_model_matrix(transform));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_3D_coloured.release();
@@ -212,6 +224,7 @@ void Quad_Renderer::draw_multiple_3D_coloured(const Camera& camera, const std::v
 	for (uint32_t i = 0; i < transform_list.size(); i++) {
 		shader_3D_coloured.set_uniform("model", utils::gen_model_matrix(transform_list[i]));
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		count_draw(GL_TRIANGLE_STRIP, 4);
 	}
 
 	glBindVertexArray(0);
@@ -228,6 +241,7 @@ void Quad_Renderer::draw_2D_textured(const Camera& camera, const vec2& position,
 	shader_2D.set_uniform("model", utils::gen_model_matrix(size, position));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_2D.release();
@@ -244,6 +258,7 @@ void Quad_Renderer::draw_3D_textured(const Camera& camera, const Transform& tran
 	shader_3D_textured.set_uniform("model", utils::gen_model_matrix(transform));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(GL_TRIANGLE_STRIP, 4);
 
 	glBindVertexArray(0);
 	shader_3D_textured.release();
@@ -283,22 +298,23 @@ void Cube_Renderer::draw(const Camera& camera, const vec3& position, const vec3&
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	shader.use();
 
-	shader.set_uniform("model", utils::gen_model_matrix(size, position, rotation));
-	shader.set_uniform("view", camera.matrix_view);
-	shader.set_uniform("projection", camera.matrix_projection_persp);
+	mat4 model = utils::gen_model_matrix(size, position, rotation);
+	shader.set_uniform("model", model);
+	shader.set_uniform("normal_matrix", normal_matrix(model));
+	shader.set_uniform("view_projection", camera.matrix_view_projection);
 	shader.set_uniform("uniform_colour", colour);
 	shader.set_uniform("light_position", vec3{ 0.f, 30.f, 0.f });
 	glDrawArrays(GL_TRIANGLES, 0, 36);
+	count_draw(GL_TRIANGLES, 36);
 
 	shader.release();
 	glBindVertexArray(0);
 }
 
-void Cube_Renderer::draw_multiple(const Camera& camera, std::map<int, Transform>& transform_list, std::map<int, Vehicle_Attributes>& vehicle_attributes, std::map<int, Light>& lights) {
+void Cube_Renderer::draw_multiple(const Camera& camera, std::map<int, Transform>& transform_list, std::map<int, Vehicle_Attributes>& vehicle_attributes, const std::vector<int>& visible, std::map<int, Light>& lights) {
 	shader.use();
 
-	shader.set_uniform("view", camera.matrix_view);
-	shader.set_uniform("projection", camera.matrix_projection_persp);
+	shader.set_uniform("view_projection", camera.matrix_view_projection);
 	shader.set_uniform("num_lights", static_cast<int>(lights.size()));
 
 	int i = 0;
@@ -313,12 +329,17 @@ void Cube_Renderer::draw_multiple(const Camera& camera, std::map<int, Transform>
 		i++;
 	}
 
-	for (std::map<int, Vehicle_Attributes>::iterator it = vehicle_attributes.begin(); it != vehicle_attributes.end(); ++it) {
+	for (size_t j = 0; j < visible.size(); j++) {
+		const Transform& t = transform_list[visible[j]];
+
 		glBindVertexArray(vao);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		shader.set_uniform("uniform_colour", it->second.colour);
-		shader.set_uniform("model", utils::gen_model_matrix(transform_list[it->first].size, transform_list[it->first].position, transform_list[it->first].rotation));
+		shader.set_uniform("uniform_colour", vehicle_attributes[visible[j]].colour);
+		mat4 model = utils::gen_model_matrix(t.size, t.position, t.rotation);
+		shader.set_uniform("model", model);
+		shader.set_uniform("normal_matrix", normal_matrix(model));
 		glDrawArrays(GL_TRIANGLES, 0, 36);
+		count_draw(GL_TRIANGLES, 36);
 		glBindVertexArray(0);
 	}
 
@@ -364,6 +385,7 @@ void Line_Renderer::draw(const Camera& camera, const vec3& world_space_a, const
 	
 	glLineWidth(4.f);
 	glDrawArrays(GL_LINES, 0, 2);
+	count_draw(GL_LINES, 2);
 }
 
 void Line_Renderer::draw_lineloop(const Camera& camera, const std::vector<vec3>& points, const vec4& colour) {
@@ -380,6 +402,7 @@ void Line_Renderer::draw_lineloop(const Camera& camera, const std::vector<vec3>&
 
 	glLineWidth(4.f);
 	glDrawArrays(GL_LINE_LOOP, 0, points.size());
+	count_draw(GL_LINE_LOOP, points.size());
 }
 
 
@@ -399,93 +422,156 @@ void Model_Renderer::init() {
 		"shaders/v.MVP_NORMALS_UVS.glsl",
 		"shaders/f.DIFFUSE_TEXTURE.glsl",
 	};
+
+	shader_textured_instanced = {
+		"shaders/v.MVP_NORMALS_UVS_INSTANCED.glsl",
+		"shaders/f.DIFFUSE_TEXTURE.glsl",
+	};
+
+	shader_wheels = {
+		"shaders/v.MVP_NORMALS_UVS_WHEELS.glsl",
+		"shaders/f.DIFFUSE_TEXTURE.glsl",
+	};
+
+	glGenBuffers(1, &vbo_instances);
 }
 
 void Model_Renderer::draw_multiple_3D_textured(int n, Model& model, const Camera& camera, const std::vector<Transform>& transform_list, Texture& texture, std::map<int, Light>& lights) {
-	shader_textured.use();
-	shader_textured.set_uniform("view", camera.matrix_view);
-	shader_textured.set_uniform("projection", camera.matrix_projection_persp);
-	shader_textured.set_uniform("num_lights", static_cast<int>(lights.size()));
+	gen_model_matrices(transform_list, n, instance_components, instance_matrices);
 
-	int i = 0;
-	for (std::map<int, Light>::iterator it = lights.begin(); it != lights.end(); ++it) {
-		Light& light = it->second;
-		std::string str = "lights[" + std::to_string(i) + "].position";
-		shader_textured.set_uniform(str.c_str(), light.position);
-		str = "lights[" + std::to_string(i) + "].colour";
-		shader_textured.set_uniform(str.c_str(), light.colour);
-		str = "lights[" + std::to_string(i) + "].intensity";
-		shader_textured.set_uniform(str.c_str(), light.intensity);
-		i++;
+	model_instances.resize(instance_matrices.size());
+	for (size_t j = 0; j < instance_matrices.size(); j++)
+		model_instances[j] = { instance_matrices[j], normal_matrix(instance_matrices[j]) };
+
+	draw_instances_3D_textured(model, camera, texture, lights);
+}
+
+void Model_Renderer::draw_wheels_3D_textured(Model& model, const Camera& camera, const std::map<int, Transform>& vehicle_transforms, const std::map<int, Vehicle_Attributes>& vehicle_attributes, const std::vector<int>& visible, const std::vector<Wheel_Attributes>& wheel_attributes, Texture& texture, std::map<int, Light>& lights) {
+	if (visible.empty())
+		return;
+
+	// Only each vehicle's ground position, heading and speed are sent, the shader expands it into its wheels
+	vehicle_instances.clear();
+	vehicle_instances.reserve(visible.size());
+
+	for (size_t j = 0; j < visible.size(); j++) {
+		const Transform& t = vehicle_transforms.at(visible[j]);
+		vehicle_instances.push_back({ t.position.x, t.position.z, t.rotation.y, vehicle_attributes.at(visible[j]).speed });
+	}
+
+	upload_instances(&vehicle_instances[0], sizeof(vec4) * vehicle_instances.size());
+
+	// Wheels past the shader's arrays are not drawn
+	GLuint wheels_per_vehicle = static_cast<GLuint>(std::min(wheel_attributes.size(), static_cast<size_t>(MAX_WHEELS)));
+	if (wheels_per_vehicle == 0)
+		return;
+
+	shader_wheels.use();
+	shader_wheels.set_uniform("view_projection", camera.matrix_view_projection);
+	shader_wheels.set_uniform("wheel_count", static_cast<int>(wheels_per_vehicle));
+
+	for (uint32_t i = 0; i < wheels_per_vehicle; i++) {
+		const Wheel_Attributes& w = wheel_attributes[i];
+		std::string index = "[" + std::to_string(i) + "]";
+		shader_wheels.set_uniform(("wheels" + index).c_str(), vec4{ w.angular_offset, w.y_rotation, w.distance, w.height });
+		shader_wheels.set_uniform(("wheel_sizes" + index).c_str(), w.size);
 	}
 
+	set_lights(shader_wheels, lights);
+
 	texture.use();
 
-	for (int j = 0; j < n; j++) {
-		shader_textured.set_uniform("model", gen_model_matrix(transform_list[j].size, transform_list[j].position, transform_list[j].rotation));
+	for (uint32_t i = 0; i < model.meshes.size(); i++) {
+		glBindVertexArray(model.meshes[i].vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_instances);
 
-		for (uint32_t i = 0; i < model.meshes.size(); i++) {
-			glBindVertexArray(model.meshes[i].vao);
-			glDrawArrays(GL_TRIANGLES, 0, model.meshes[i].vertices.size());
-			glBindVertexArray(0);
-		}
+		for (GLuint column = 1; column < 7; column++)
+			glDisableVertexAttribArray(3 + column);
+
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(vec4), 0);
+		glVertexAttribDivisor(3, wheels_per_vehicle);
+
+		glDrawElementsInstanced(GL_TRIANGLES, model.meshes[i].index_count, GL_UNSIGNED_INT, 0, vehicle_instances.size() * wheels_per_vehicle);
+		count_draw(GL_TRIANGLES, model.meshes[i].index_count, vehicle_instances.size() * wheels_per_vehicle);
+		glBindVertexArray(0);
 	}
 
-	shader_textured.release();
+	shader_wheels.release();
 }
 
-void Model_Renderer::draw_multiple_3D_textured(int n, Model& model, const Camera& camera, std::map<int, std::vector<Transform>>& transform_list, Texture& texture, std::map<int, Light>& lights) {
-	shader_textured.use();
-	shader_textured.set_uniform("view", camera.matrix_view);
-	shader_textured.set_uniform("projection", camera.matrix_projection_persp);
-	shader_textured.set_uniform("num_lights", static_cast<int>(lights.size()));
+void Model_Renderer::set_lights(Shader& shader, std::map<int, Light>& lights) {
+	shader.set_uniform("num_lights", static_cast<int>(lights.size()));
 
 	int i = 0;
 	for (std::map<int, Light>::iterator it = lights.begin(); it != lights.end(); ++it) {
 		Light& light = it->second;
 		std::string str = "lights[" + std::to_string(i) + "].position";
-		shader_textured.set_uniform(str.c_str(), light.position);
+		shader.set_uniform(str.c_str(), light.position);
 		str = "lights[" + std::to_string(i) + "].colour";
-		shader_textured.set_uniform(str.c_str(), light.colour);
+		shader.set_uniform(str.c_str(), light.colour);
 		str = "lights[" + std::to_string(i) + "].intensity";
-		shader_textured.set_uniform(str.c_str(), light.intensity);
+		shader.set_uniform(str.c_str(), light.intensity);
 		i++;
 	}
+}
 
-	texture.use();
+void Model_Renderer::upload_instances(const void* data, size_t size) {
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_instances);
+	if (size > vbo_instances_capacity) {
+		vbo_instances_capacity = size * 2;
+		glBufferData(GL_ARRAY_BUFFER, vbo_instances_capacity, NULL, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+}
 
-	for (std::map<int, std::vector<Transform>>::iterator it = transform_list.begin(); it != transform_list.end(); ++it) {
+void Model_Renderer::draw_instances_3D_textured(Model& model, const Camera& camera, Texture& texture, std::map<int, Light>& lights) {
+	if (model_instances.empty())
+		return;
 
-		std::vector<Transform> t = it->second;
+	upload_instances(&model_instances[0], sizeof(Model_Instance) * model_instances.size());
 
-		for (uint32_t j = 0; j < t.size(); j++) {
-			shader_textured.set_uniform("model", gen_model_matrix(t[j].size, t[j].position, t[j].rotation));
+	shader_textured_instanced.use();
+	shader_textured_instanced.set_uniform("view_projection", camera.matrix_view_projection);
 
-			for (uint32_t i = 0; i < model.meshes.size(); i++) {
-				glBindVertexArray(model.meshes[i].vao);
-				glDrawArrays(GL_TRIANGLES, 0, model.meshes[i].vertices.size());
-				glBindVertexArray(0);
-			}
-		}		
-	}
+	set_lights(shader_textured_instanced, lights);
+
+	texture.use();
 
+	// One draw per mesh covers every instance, the model matrix takes locations 3 to 6 and the normal matrix 7 to 9
+	for (uint32_t i = 0; i < model.meshes.size(); i++) {
+		glBindVertexArray(model.meshes[i].vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_instances);
 
+		for (GLuint column = 0; column < 7; column++) {
+			GLuint offset = (column < 4) ? offsetof(Model_Instance, model) + sizeof(vec4) * column : offsetof(Model_Instance, normal) + sizeof(vec4) * (column - 4);
+			glEnableVertexAttribArray(3 + column);
+			glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(Model_Instance), (void*)(offset));
+			glVertexAttribDivisor(3 + column, 1);
+		}
 
-	shader_textured.release();
+		glDrawElementsInstanced(GL_TRIANGLES, model.meshes[i].index_count, GL_UNSIGNED_INT, 0, model_instances.size());
+		count_draw(GL_TRIANGLES, model.meshes[i].index_count, model_instances.size());
+		glBindVertexArray(0);
+	}
+
+	shader_textured_instanced.release();
 }
 
 void Model_Renderer::draw_3D_textured(Model& model, const Camera& camera, const Transform& transform, Texture& texture) {
 	shader_textured.use();
-	shader_textured.set_uniform("view", camera.matrix_view);
-	shader_textured.set_uniform("projection", camera.matrix_projection_persp);
+	mat4 model_matrix = gen_model_matrix(transform.size, transform.position, transform.rotation);
+	shader_textured.set_uniform("view_projection", camera.matrix_view_projection);
 	shader_textured.set_uniform("light_position", vec3{ 0.f, 30.f, 0.f });
-	shader_textured.set_uniform("model", gen_model_matrix(transform.size, transform.position, transform.rotation));
+	shader_textured.set_uniform("model", model_matrix);
+	shader_textured.set_uniform("normal_matrix", normal_matrix(model_matrix));
 
 	texture.use();
 
 	for (uint32_t i = 0; i < model.meshes.size(); i++) {
 		glBindVertexArray(model.meshes[i].vao);
-		glDrawArrays(GL_TRIANGLES, 0, model.meshes[i].vertices.size());
+		glDrawElements(GL_TRIANGLES, model.meshes[i].index_count, GL_UNSIGNED_INT, 0);
+		count_draw(GL_TRIANGLES, model.meshes[i].index_count);
 		glBindVertexArray(0);
 	}
 
@@ -493,16 +579,20 @@ void Model_Renderer::draw_3D_textured(Model& model, const Camera& camera, const
 }
 
 void Model_Renderer::draw_3D_coloured(Model& model, const Camera& camera, const Transform& transform, const vec4& colour) {
+	mat4 model_matrix = gen_model_matrix(transform.size, transform.position, transform.rotation);
+	mat4 model_normal_matrix = normal_matrix(model_matrix);
+
 	for (uint32_t i = 0; i < model.meshes.size(); i++) {
 		glBindVertexArray(model.meshes[i].vao);
 		shader_coloured.use();
 
-		shader_coloured.set_uniform("model", gen_model_matrix(transform.size, transform.position, transform.rotation));
-		shader_coloured.set_uniform("view", camera.matrix_view);
-		shader_coloured.set_uniform("projection", camera.matrix_projection_persp);
+		shader_coloured.set_uniform("model", model_matrix);
+		shader_coloured.set_uniform("normal_matrix", model_normal_matrix);
+		shader_coloured.set_uniform("view_projection", camera.matrix_view_projection);
 		shader_coloured.set_uniform("uniform_colour", colour);
 		shader_coloured.set_uniform("light_position", vec3{ 0.f, 30.f, 0.f });
-		glDrawArrays(GL_TRIANGLES, 0, model.meshes[i].vertices.size());
+		glDrawElements(GL_TRIANGLES, model.meshes[i].index_count, GL_UNSIGNED_INT, 0);
+		count_draw(GL_TRIANGLES, model.meshes[i].index_count);
 
 		shader_coloured.release();
 		glBindVertexArray(0);
@@ -510,47 +600,205 @@ void Model_Renderer::draw_3D_coloured(Model& model, const Camera& camera, const
 }
 
 void Model_Renderer::destroy() {
+	glDeleteBuffers(1, &vbo_instances);
 	shader_coloured.destroy();
 	shader_textured.destroy();
+	shader_textured_instanced.destroy();
+	shader_wheels.destroy();
+}
+
+namespace {
+	const int ATLAS_WIDTH = 512;
+	const int GLYPH_PADDING = 1;
+
+	const char FONT_ATLAS_MAGIC[4] = { 'G', 'L', 'V', 'F' };
+	const uint32_t FONT_ATLAS_VERSION = 1;
+
+	// Followed by the 128 glyphs and then ATLAS_WIDTH * atlas_height bytes of coverage
+	struct Font_Atlas_Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t source_size;
+		int64_t source_time;
+		int32_t pixel_size;
+		int32_t atlas_width;
+		int32_t atlas_height;
+		int32_t glyph_size;
+	};
 }
 
-void Text_Renderer::init(const vec2& screen_resolution) {
-	{
+std::string Text_Renderer::baked_filename() const {
+	return font + "." + std::to_string(pixel_size) + ".atlas";
+}
+
+void Text_Renderer::rasterise() {
+	// FreeType is only touched when there is no current baked atlas for this font and size
+	if (!load_baked() && bake())
+		write_baked();
+
+	rasterised = true;
+}
+
+bool Text_Renderer::load_baked() {
+	std::string filename = baked_filename();
+
+	// The asset pack only returns an atlas whose font is unchanged since the pack was built
+	const char* data;
+	size_t size;
+	Mapped_File file;
+	bool packed = asset_pack.find(filename, data, size);
+
+	uint64_t source_size;
+	int64_t source_time;
+	if (!packed) {
+		// Stamping the atlas first keeps a missing one quiet rather than logged by Mapped_File
+		uint64_t atlas_size;
+		int64_t atlas_time;
+		if (!file_stamp(font.c_str(), source_size, source_time) || !file_stamp(filename.c_str(), atlas_size, atlas_time) || !file.init(filename.c_str()))
+			return false;
+
+		data = file.data;
+		size = file.size;
+	}
+
+	const Font_Atlas_Header* header = reinterpret_cast<const Font_Atlas_Header*>(data);
+	if (size < sizeof(Font_Atlas_Header) || memcmp(header->magic, FONT_ATLAS_MAGIC, 4) != 0 || header->version != FONT_ATLAS_VERSION ||
+		(!packed && (header->source_size != source_size || header->source_time != source_time)) || header->pixel_size != pixel_size ||
+		header->atlas_width != ATLAS_WIDTH || header->glyph_size != static_cast<int32_t>(sizeof(Glyph)) || header->atlas_height <= 0)
+		return false;
+
+	size_t pixel_count = static_cast<size_t>(ATLAS_WIDTH) * header->atlas_height;
+	if (size < sizeof(Font_Atlas_Header) + sizeof(glyphs) + pixel_count)
+		return false;
+
+	const char* p = data + sizeof(Font_Atlas_Header);
+	memcpy(reinterpret_cast<void*>(glyphs), p, sizeof(glyphs));
+	p += sizeof(glyphs);
+
+	atlas_pixels.assign(p, p + pixel_count);
+	atlas_height = header->atlas_height;
+	return true;
+}
+
+void Text_Renderer::write_baked() {
+	Font_Atlas_Header header;
+	if (!file_stamp(font.c_str(), header.source_size, header.source_time))
+		return;
+
+	memcpy(header.magic, FONT_ATLAS_MAGIC, 4);
+	header.version = FONT_ATLAS_VERSION;
+	header.pixel_size = pixel_size;
+	header.atlas_width = ATLAS_WIDTH;
+	header.atlas_height = atlas_height;
+	header.glyph_size = static_cast<int32_t>(sizeof(Glyph));
+
+	std::string filename = baked_filename();
+	std::ofstream ofs(temp_filename(filename.c_str()).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(glyphs), sizeof(glyphs));
+	ofs.write(reinterpret_cast<const char*>(atlas_pixels.data()), atlas_pixels.size());
+	commit_file(ofs, filename.c_str());
+}
+
+bool Text_Renderer::bake() {
+	// Without a font every glyph is empty and the atlas a single blank row, so text draws nothing rather than garbage
+	atlas_height = 1;
+	atlas_pixels.assign(ATLAS_WIDTH, 0);
+	for (int c = 0; c < 128; c++)
+		glyphs[c] = Glyph();
+
+	{ // Rasterise every glyph into a single atlas, packed row by row
 		FT_Library ft_lib;
 		FT_Face ff;
 
-		FT_Init_FreeType(&ft_lib);
-		FT_New_Face(ft_lib, font.c_str(), 0, &ff);
+		if (FT_Init_FreeType(&ft_lib) != 0) {
+			std::cout << "FreeType failed to initialise" << std::endl;
+			return false;
+		}
+
+		if (FT_New_Face(ft_lib, font.c_str(), 0, &ff) != 0) {
+			std::cout << "Failed to load font " << font << std::endl;
+			FT_Done_FreeType(ft_lib);
+			return false;
+		}
+
+		atlas_pixels.clear();
+		atlas_height = 0;
+
 		FT_Set_Pixel_Sizes(ff, 0, pixel_size);
 
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		int pen_x = 0;
+		int pen_y = 0;
+		int row_height = 0;
+		vec4 pixel_rects[128];
 
 		for (GLubyte c = 0; c < 128; ++c) {
 			FT_Load_Char(ff, c, FT_LOAD_RENDER);
+			FT_Bitmap& bitmap = ff->glyph->bitmap;
 
-			GLuint tex;
-			glGenTextures(1, &tex);
-			glBindTexture(GL_TEXTURE_2D, tex);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ff->glyph->bitmap.width, ff->glyph->bitmap.rows, 0, GL_RED, GL_UNSIGNED_BYTE, ff->glyph->bitmap.buffer);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			glyph_map.insert(std::pair<GLchar, Glyph>(
-				c,
-				{
-					tex,
-					ff->glyph->advance.x,
-					vec2(static_cast<float>(ff->glyph->bitmap.width), static_cast<float>(ff->glyph->bitmap.rows)),
-					vec2(static_cast<float>(ff->glyph->bitmap_left), static_cast<float>(ff->glyph->bitmap_top))
-				}
-			));
+			int w = static_cast<int>(bitmap.width);
+			int h = static_cast<int>(bitmap.rows);
+
+			if (pen_x + w + GLYPH_PADDING > ATLAS_WIDTH) {
+				pen_x = 0;
+				pen_y += row_height + GLYPH_PADDING;
+				row_height = 0;
+			}
+
+			if (pen_y + h > atlas_height) {
+				atlas_height = pen_y + h;
+				atlas_pixels.resize(ATLAS_WIDTH * atlas_height, 0);
+			}
+
+			for (int row = 0; row < h; row++)
+				std::copy(bitmap.buffer + row * bitmap.pitch, bitmap.buffer + row * bitmap.pitch + w, atlas_pixels.begin() + (pen_y + row) * ATLAS_WIDTH + pen_x);
+
+			pixel_rects[c] = vec4(static_cast<float>(pen_x), static_cast<float>(pen_y), static_cast<float>(pen_x + w), static_cast<float>(pen_y + h));
+
+			glyphs[c] = {
+				static_cast<float>(ff->glyph->advance.x >> 6),
+				vec2(static_cast<float>(w), static_cast<float>(h)),
+				vec2(static_cast<float>(ff->glyph->bitmap_left), static_cast<float>(ff->glyph->bitmap_top)),
+				vec4()
+			};
+
+			pen_x += w + GLYPH_PADDING;
+			row_height = std::max(row_height, h);
 		}
 
 		FT_Done_Face(ff);
 		FT_Done_FreeType(ft_lib);
+
+		atlas_height = std::max(atlas_height, 1);
+		atlas_pixels.resize(ATLAS_WIDTH * atlas_height, 0);
+
+		for (int c = 0; c < 128; c++) {
+			const vec4& r = pixel_rects[c];
+			glyphs[c].uvs = vec4(r.x / ATLAS_WIDTH, r.y / atlas_height, r.z / ATLAS_WIDTH, r.w / atlas_height);
+		}
+	}
+
+	return true;
+}
+
+void Text_Renderer::init(const vec2& screen_resolution) {
+	if (!rasterised)
+		rasterise();
+
+	{ // Atlas Texture
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		glGenTextures(1, &atlas_texture);
+		glBindTexture(GL_TEXTURE_2D, atlas_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ATLAS_WIDTH, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas_pixels.data());
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		atlas_pixels = std::vector<unsigned char>();
 	}
 
 	{ // GL Data
@@ -559,10 +807,14 @@ void Text_Renderer::init(const vec2& screen_resolution) {
 
 		glGenBuffers(1, &vbo);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
 
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Text_Vertex), 0);
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Text_Vertex), (void*)(sizeof(vec4)));
+
+		glBindVertexArray(0);
 	}
 
 	{ // Shaders
@@ -571,59 +823,97 @@ void Text_Renderer::init(const vec2& screen_resolution) {
 			"shaders/f.text.glsl"
 		};
 
-		shader.set_uniform("colour", vec4(1.f, 1.f, 1.f, 1.f));
 		shader.set_uniform("projection", orthographic_matrix(screen_resolution, -1.f, 1.f, mat4()));
 	}
 }
 
-void Text_Renderer::draw(const std::string& msg, const vec2& position, bool centered, const vec4& colour) {
-	shader.use();
-	shader.set_uniform("colour", colour);
+const Text_Renderer::Text_Layout& Text_Renderer::layout(const std::string& msg) {
+	const static size_t MAX_CACHED_LAYOUTS = 512;
 
-	glBindVertexArray(vao);
-	glActiveTexture(GL_TEXTURE0);
+	std::unordered_map<std::string, Text_Layout>::iterator it = layout_cache.find(msg);
+	if (it != layout_cache.end())
+		return it->second;
 
-	float x = position.x;
+	// Strings such as energy readouts change every tick, so don't let them accumulate forever
+	if (layout_cache.size() >= MAX_CACHED_LAYOUTS)
+		layout_cache.clear();
 
-	if (centered) {
-		float x_ = x;
-		for (GLchar c : msg)
-			x_ += (glyph_map[c].next_glyph_offset >> 6);
-
-		x -= ((x_ - x) * .5f);
-	}
+	Text_Layout text_layout = { 0.f, {} };
+	text_layout.vertices.reserve(msg.size() * 6);
 
 	for (GLchar c : msg) {
-		Glyph g = glyph_map[c];
+		const Glyph& g = glyphs[static_cast<GLubyte>(c) & 127];
 
-		float xPos = x + g.bearing_offset.x;
-		float yPos = position.y - (g.glyph_size.y - g.bearing_offset.y);
+		float xPos = text_layout.width + g.bearing_offset.x;
+		float yPos = -(g.glyph_size.y - g.bearing_offset.y);
 
-		x += (g.next_glyph_offset >> 6);
+		text_layout.width += g.next_glyph_offset;
 
-		float vertices[6][4] = {
-			{ xPos,                  yPos + g.glyph_size.y, 0.f, 0.f },
-			{ xPos,                  yPos,                  0.f, 1.f },
-			{ xPos + g.glyph_size.x, yPos,                  1.f, 1.f },
-			{ xPos,                  yPos + g.glyph_size.y, 0.f, 0.f },
-			{ xPos + g.glyph_size.x, yPos,                  1.f, 1.f },
-			{ xPos + g.glyph_size.x, yPos + g.glyph_size.y, 1.f, 0.f }
+		if (g.glyph_size.x == 0.f || g.glyph_size.y == 0.f)
+			continue;
+
+		vec4 vertices[6] = {
+			{ xPos,                  yPos + g.glyph_size.y, g.uvs.x, g.uvs.y },
+			{ xPos,                  yPos,                  g.uvs.x, g.uvs.w },
+			{ xPos + g.glyph_size.x, yPos,                  g.uvs.z, g.uvs.w },
+			{ xPos,                  yPos + g.glyph_size.y, g.uvs.x, g.uvs.y },
+			{ xPos + g.glyph_size.x, yPos,                  g.uvs.z, g.uvs.w },
+			{ xPos + g.glyph_size.x, yPos + g.glyph_size.y, g.uvs.z, g.uvs.y }
 		};
 
-		glBindTexture(GL_TEXTURE_2D, g.data);
+		text_layout.vertices.insert(text_layout.vertices.end(), vertices, vertices + 6);
+	}
+
+	return layout_cache.insert(std::pair<std::string, Text_Layout>(msg, text_layout)).first->second;
+}
 
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+void Text_Renderer::draw(const std::string& msg, const vec2& position, bool centered, const vec4& colour) {
+	const Text_Layout& text_layout = layout(msg);
 
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+	float x = position.x;
+	if (centered)
+		x -= text_layout.width * .5f;
+
+	for (const vec4& v : text_layout.vertices)
+		batch.push_back({ { v.x + x, v.y + position.y, v.z, v.w }, colour });
+}
+
+void Text_Renderer::flush() {
+	if (batch.empty())
+		return;
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	// The HUD is usually identical between frames, in which case last frame's upload is reused
+	bool changed = batch.size() != uploaded_batch.size() || memcmp(&batch[0], &uploaded_batch[0], sizeof(Text_Vertex) * batch.size()) != 0;
+	if (changed) {
+		if (batch.size() > vbo_capacity) {
+			vbo_capacity = batch.size() * 2;
+			glBufferData(GL_ARRAY_BUFFER, sizeof(Text_Vertex) * vbo_capacity, NULL, GL_DYNAMIC_DRAW);
+		}
+
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Text_Vertex) * batch.size(), &batch[0]);
+		uploaded_batch.swap(batch);
 	}
 
+	shader.use();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, atlas_texture);
+
+	glDrawArrays(GL_TRIANGLES, 0, uploaded_batch.size());
+	count_draw(GL_TRIANGLES, uploaded_batch.size());
+
 	glBindVertexArray(0);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	shader.release();
+
+	batch.clear();
 }
 
 void Text_Renderer::destroy() {
 	shader.destroy();
+	glDeleteTextures(1, &atlas_texture);
 	glDeleteBuffers(1, &vbo);
 	glDeleteVertexArrays(1, &vao);
 }
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include "..\include\replay.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	const char REPLAY_MAGIC[4] = { 'G', 'L', 'V', 'R' };
+	const uint32_t REPLAY_VERSION = 1;
+
+	const uint8_t RECORD_KEYFRAME = 'K';
+	const uint8_t RECORD_DELTA = 'D';
+
+	struct Replay_Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t keyframe_interval;
+	};
+
+	// LEB128 for unsigned values, signed values are zigzagged first so small magnitudes stay one byte
+	void write_varint(std::vector<uint8_t>& out, uint64_t v) {
+		while (v >= 0x80) {
+			out.push_back(static_cast<uint8_t>(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(v));
+	}
+
+	uint64_t zigzag(int64_t v) {
+		return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+	}
+
+	int64_t unzigzag(uint64_t v) {
+		return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+	}
+
+	void write_float(std::vector<uint8_t>& out, float f) {
+		uint8_t bytes[sizeof(float)];
+		memcpy(bytes, &f, sizeof(float));
+		out.insert(out.end(), bytes, bytes + sizeof(float));
+	}
+
+	struct Reader {
+		const uint8_t* p;
+		const uint8_t* end;
+		bool ok;
+
+		uint64_t varint() {
+			uint64_t v = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				if (p >= end)
+					break;
+				uint8_t b = *p++;
+				v |= static_cast<uint64_t>(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			ok = false;
+			return 0;
+		}
+
+		uint8_t byte() {
+			if (p >= end) {
+				ok = false;
+				return 0;
+			}
+			return *p++;
+		}
+
+		float real() {
+			float f = 0.f;
+			if (p + sizeof(float) > end)
+				ok = false;
+			else
+				memcpy(&f, p, sizeof(float));
+			p += sizeof(float);
+			return f;
+		}
+	};
+
+	void quantise(const Transform& t, const Vehicle_Attributes& a, int32_t* q) {
+		q[replay::X] = static_cast<int32_t>(lroundf(t.position.x * replay::POSITION_SCALE));
+		q[replay::Z] = static_cast<int32_t>(lroundf(t.position.z * replay::POSITION_SCALE));
+		q[replay::HEADING] = static_cast<int32_t>(lroundf(t.rotation.y * replay::HEADING_SCALE));
+		q[replay::ENERGY] = static_cast<int32_t>(lroundf(a.energy * replay::ENERGY_SCALE));
+		q[replay::SPEED] = static_cast<int32_t>(lroundf(a.speed * replay::SPEED_SCALE));
+	}
+
+	// Vehicles move smoothly and energy drains at a constant rate, so last value plus last change is usually exact or close
+	int32_t predict(const Replay_Track& track, int field) {
+		if (track.fresh)
+			return 0;
+		return track.value[field] + (track.value[field] - track.previous[field]);
+	}
+
+	void advance(Replay_Track& track, int field, int32_t v) {
+		track.previous[field] = track.fresh ? v : track.value[field];
+		track.value[field] = v;
+	}
+}
+
+Replay_Recorder::Replay_Recorder() : keyframe_interval(300), records(0), event_count(0) {
+}
+
+bool Replay_Recorder::init(const char* filename, int keyframe_interval) {
+	destroy();
+
+	ofs.open(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to open replay " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	this->keyframe_interval = keyframe_interval;
+	records = 0;
+
+	Replay_Header header;
+	memcpy(header.magic, REPLAY_MAGIC, 4);
+	header.version = REPLAY_VERSION;
+	header.keyframe_interval = static_cast<uint32_t>(keyframe_interval);
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	return true;
+}
+
+void Replay_Recorder::destroy() {
+	if (ofs.is_open())
+		ofs.close();
+
+	tracks.clear();
+	event_bytes.clear();
+	event_count = 0;
+}
+
+bool Replay_Recorder::is_open() const {
+	return ofs.is_open();
+}
+
+void Replay_Recorder::spawn(int id, bool is_predator, const Vehicle_Sensors& sensors) {
+	if (!is_open())
+		return;
+
+	Replay_Track track = {};
+	track.is_predator = is_predator;
+	track.sensor_angle = sensors.angle;
+	track.sensor_offset = sensors.offset;
+	track.sensor_range = sensors.range;
+	track.fresh = true;
+	tracks[id] = track;
+
+	// Encoded now, the vehicle can be gone again before the tick is recorded
+	event_count++;
+	event_bytes.push_back(replay::SPAWN);
+	write_varint(event_bytes, id);
+	event_bytes.push_back(is_predator ? 1 : 0);
+	write_float(event_bytes, sensors.angle);
+	write_float(event_bytes, sensors.offset);
+	write_float(event_bytes, sensors.range);
+}
+
+void Replay_Recorder::despawn(int id) {
+	if (!is_open())
+		return;
+
+	tracks.erase(id);
+
+	event_count++;
+	event_bytes.push_back(replay::DESPAWN);
+	write_varint(event_bytes, id);
+}
+
+void Replay_Recorder::caught(int predator_id, int prey_id) {
+	if (!is_open())
+		return;
+
+	event_count++;
+	event_bytes.push_back(replay::CATCH);
+	write_varint(event_bytes, predator_id);
+	write_varint(event_bytes, prey_id);
+}
+
+void Replay_Recorder::record(int tick, const map<int, Transform>& transforms, const map<int, Vehicle_Attributes>& attributes) {
+	if (!is_open())
+		return;
+
+	bool keyframe = (records++ % keyframe_interval) == 0;
+
+	// A vehicle that went without a despawn is dropped here, the player walks the same tracks and would fall out of step otherwise
+	for (map<int, Replay_Track>::iterator it = tracks.begin(); it != tracks.end();) {
+		int id = (it++)->first;
+		if (transforms.find(id) == transforms.end() || attributes.find(id) == attributes.end())
+			despawn(id);
+	}
+
+	payload.clear();
+	write_varint(payload, event_count);
+	payload.insert(payload.end(), event_bytes.begin(), event_bytes.end());
+	event_bytes.clear();
+	event_count = 0;
+
+	if (keyframe) {
+		write_varint(payload, tracks.size());
+		for (map<int, Replay_Track>::iterator it = tracks.begin(); it != tracks.end(); ++it) {
+			Replay_Track& t = it->second;
+			int32_t q[replay::FIELD_COUNT];
+			quantise(transforms.find(it->first)->second, attributes.find(it->first)->second, q);
+
+			write_varint(payload, it->first);
+			payload.push_back(t.is_predator ? 1 : 0);
+			write_float(payload, t.sensor_angle);
+			write_float(payload, t.sensor_offset);
+			write_float(payload, t.sensor_range);
+
+			// Prediction restarts from each keyframe so decoding can begin at any of them
+			t.fresh = true;
+			for (int f = 0; f < replay::FIELD_COUNT; f++) {
+				write_varint(payload, zigzag(q[f]));
+				advance(t, f, q[f]);
+			}
+			t.fresh = false;
+		}
+	}
+	else {
+		// Residuals are run-length coded, an odd token is a run of zeros and an even one a single non-zero residual
+		uint64_t zeros = 0;
+		for (map<int, Replay_Track>::iterator it = tracks.begin(); it != tracks.end(); ++it) {
+			Replay_Track& t = it->second;
+			int32_t q[replay::FIELD_COUNT];
+			quantise(transforms.find(it->first)->second, attributes.find(it->first)->second, q);
+
+			for (int f = 0; f < replay::FIELD_COUNT; f++) {
+				int64_t residual = static_cast<int64_t>(q[f]) - predict(t, f);
+				advance(t, f, q[f]);
+
+				if (residual == 0) {
+					zeros++;
+					continue;
+				}
+
+				if (zeros > 0) {
+					write_varint(payload, (zeros << 1) | 1);
+					zeros = 0;
+				}
+				write_varint(payload, zigzag(residual) << 1);
+			}
+			t.fresh = false;
+		}
+
+		if (zeros > 0)
+			write_varint(payload, (zeros << 1) | 1);
+	}
+
+	std::vector<uint8_t> header;
+	header.push_back(keyframe ? RECORD_KEYFRAME : RECORD_DELTA);
+	write_varint(header, static_cast<uint64_t>(tick));
+	write_varint(header, payload.size());
+
+	ofs.write(reinterpret_cast<const char*>(header.data()), header.size());
+	ofs.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+
+	// A run cut short still leaves everything up to the last keyframe readable
+	if (keyframe)
+		ofs.flush();
+}
+
+Replay_Player::Replay_Player() : tick(0), first_tick(0), last_tick(0), next_offset(0), end_offset(0) {
+}
+
+bool Replay_Player::init(const char* filename) {
+	destroy();
+
+	if (!file.init(filename))
+		return false;
+
+	const Replay_Header* header = reinterpret_cast<const Replay_Header*>(file.data);
+	if (file.size < sizeof(Replay_Header) || memcmp(header->magic, REPLAY_MAGIC, 4) != 0 || header->version != REPLAY_VERSION) {
+		std::cout << filename << " is not a compatible replay" << std::endl;
+		destroy();
+		return false;
+	}
+
+	// Only record headers are read here, payloads are skipped by their size
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(file.data);
+	size_t offset = sizeof(Replay_Header);
+	while (offset < file.size) {
+		Reader r = { base + offset, base + file.size, true };
+		uint8_t type = r.byte();
+		int record_tick = static_cast<int>(r.varint());
+		uint64_t size = r.varint();
+
+		if (!r.ok || size > static_cast<uint64_t>(r.end - r.p) || (type != RECORD_KEYFRAME && type != RECORD_DELTA))
+			break;
+
+		if (type == RECORD_KEYFRAME)
+			keyframes.push_back({ record_tick, offset });
+
+		last_tick = record_tick;
+		offset = (r.p - base) + static_cast<size_t>(size);
+	}
+	end_offset = offset;
+
+	if (keyframes.empty()) {
+		std::cout << filename << " holds no complete keyframe" << std::endl;
+		destroy();
+		return false;
+	}
+
+	first_tick = keyframes[0].tick;
+	return seek(first_tick);
+}
+
+void Replay_Player::destroy() {
+	file.destroy();
+	keyframes.clear();
+	tracks.clear();
+	events.clear();
+	tick = first_tick = last_tick = 0;
+	next_offset = end_offset = 0;
+}
+
+bool Replay_Player::is_open() const {
+	return !keyframes.empty();
+}
+
+bool Replay_Player::step() {
+	if (next_offset >= end_offset)
+		return false;
+	return decode(next_offset);
+}
+
+bool Replay_Player::seek(int target_tick) {
+	if (keyframes.empty())
+		return false;
+
+	size_t k = 0;
+	while (k + 1 < keyframes.size() && keyframes[k + 1].tick <= target_tick)
+		k++;
+
+	if (!decode(keyframes[k].offset))
+		return false;
+
+	while (tick < target_tick && step());
+	return true;
+}
+
+bool Replay_Player::decode(size_t offset) {
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(file.data);
+	Reader r = { base + offset, base + end_offset, true };
+
+	uint8_t type = r.byte();
+	int record_tick = static_cast<int>(r.varint());
+	uint64_t size = r.varint();
+	const uint8_t* record_end = r.p + size;
+	r.end = record_end;
+
+	bool keyframe = type == RECORD_KEYFRAME;
+
+	// Keyframes restate every vehicle, so their spawn and despawn events are kept for reporting but not applied
+	events.clear();
+	uint64_t event_count = r.varint();
+	for (uint64_t i = 0; i < event_count && r.ok; i++) {
+		Replay_Event e = { static_cast<replay::Event_Kind>(r.byte()), static_cast<int>(r.varint()), 0 };
+
+		if (e.kind == replay::SPAWN) {
+			Replay_Track track = {};
+			track.is_predator = r.byte() != 0;
+			track.sensor_angle = r.real();
+			track.sensor_offset = r.real();
+			track.sensor_range = r.real();
+			track.fresh = true;
+			if (!keyframe)
+				tracks[e.id] = track;
+		}
+		else if (e.kind == replay::DESPAWN) {
+			if (!keyframe)
+				tracks.erase(e.id);
+		}
+		else {
+			e.other = static_cast<int>(r.varint());
+		}
+
+		events.push_back(e);
+	}
+
+	if (keyframe) {
+		tracks.clear();
+		uint64_t count = r.varint();
+		for (uint64_t i = 0; i < count && r.ok; i++) {
+			int id = static_cast<int>(r.varint());
+			Replay_Track& t = tracks[id];
+			t.is_predator = r.byte() != 0;
+			t.sensor_angle = r.real();
+			t.sensor_offset = r.real();
+			t.sensor_range = r.real();
+
+			t.fresh = true;
+			for (int f = 0; f < replay::FIELD_COUNT; f++)
+				advance(t, f, static_cast<int32_t>(unzigzag(r.varint())));
+			t.fresh = false;
+		}
+	}
+	else {
+		uint64_t zeros = 0;
+		for (map<int, Replay_Track>::iterator it = tracks.begin(); it != tracks.end() && r.ok; ++it) {
+			Replay_Track& t = it->second;
+			for (int f = 0; f < replay::FIELD_COUNT; f++) {
+				int64_t residual = 0;
+				if (zeros == 0) {
+					uint64_t token = r.varint();
+					if (token & 1)
+						zeros = token >> 1;
+					else
+						residual = unzigzag(token >> 1);
+				}
+
+				if (zeros > 0)
+					zeros--;
+
+				advance(t, f, static_cast<int32_t>(predict(t, f) + residual));
+			}
+			t.fresh = false;
+		}
+	}
+
+	if (!r.ok)
+		return false;
+
+	tick = record_tick;
+	next_offset = record_end - base;
+	return true;
+}
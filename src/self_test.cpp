@@ -0,0 +1,301 @@
+#include "..\include\self_test.h"
+#include "..\include\model.h"
+#include "..\include\replay.h"
+#include "..\include\simulation.h"
+#include "..\include\state_hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace {
+	int failures = 0;
+
+	void check(bool passed, const std::string& what) {
+		if (!passed) {
+			std::cout << "FAILED " << what << std::endl;
+			failures++;
+		}
+	}
+
+	std::string hex(uint64_t v, int digits) {
+		std::ostringstream ss;
+		ss << "0x" << std::hex << std::uppercase << std::setw(digits) << std::setfill('0') << v;
+		return ss.str();
+	}
+
+	// Reference values from the xxHash library, covering the empty input, each tail path and the 32 byte stripes
+	void test_xxhash64() {
+		const char* input = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+		struct Vector {
+			size_t length;
+			uint64_t seed;
+			uint64_t hash;
+		};
+
+		const Vector vectors[] = {
+			{  0, 0, 0xEF46DB3751D8E999ULL },
+			{  1, 0, 0xD24EC4F1A98C6E5BULL },
+			{  4, 0, 0xDE0327B0D25D92CCULL },
+			{  8, 0, 0x3AD351775B4634B7ULL },
+			{ 32, 0, 0xBF2CD639B4143B80ULL },
+			{ 62, 0, 0xD5000C4AC53D14A0ULL },
+			{  0, 2654435761ULL, 0xAC75FDA2929B17EFULL },
+			{  1, 2654435761ULL, 0x393DA8B78992279BULL },
+			{  4, 2654435761ULL, 0x66150D50767198EEULL },
+			{  8, 2654435761ULL, 0xDCF6C3EAE6EA060FULL },
+			{ 32, 2654435761ULL, 0x5936BAA14FD050BBULL },
+			{ 62, 2654435761ULL, 0xDB00195B48C5E330ULL }
+		};
+
+		for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+			const Vector& v = vectors[i];
+			uint64_t hash = xxhash64(input, v.length, v.seed);
+			check(hash == v.hash, "xxhash64 of " + std::to_string(v.length) + " bytes with seed " + std::to_string(v.seed) +
+				" gave " + hex(hash, 16) + ", expected " + hex(v.hash, 16));
+		}
+	}
+
+	// Curved paths and a changing vehicle set, so deltas carry non-zero residuals and spawns and despawns land between keyframes
+	void replay_state(int id, int tick, Transform& t, Vehicle_Attributes& a) {
+		t = Transform();
+		t.position = vec3{ 10.f + id * 5.f + 0.37f * tick * tick, 0.f, id - 0.5f * tick };
+		t.rotation = vec3{ 0.f, fmodf(id * 40.f + 7.f * tick, 360.f), 0.f };
+
+		a = Vehicle_Attributes();
+		a.energy = 100.f - 0.25f * tick * id;
+		a.speed = 3.f + sinf(static_cast<float>(tick));
+	}
+
+	void test_replay() {
+		const char* filename = "self_test.replay";
+		const int TICKS = 11;
+		const int KEYFRAME_INTERVAL = 4;
+
+		// Quantised the same way Replay_Recorder does, which is what playback has to reproduce exactly
+		std::vector<map<int, std::vector<int32_t>>> expected(TICKS);
+
+		Replay_Recorder recorder;
+		if (!recorder.init(filename, KEYFRAME_INTERVAL)) {
+			check(false, "replay recorder opens " + std::string(filename));
+			return;
+		}
+
+		// Vehicle 1 is the only predator
+		Vehicle_Sensors sensors = Vehicle_Sensors();
+		map<int, bool> alive;
+		recorder.spawn(1, true, sensors);
+		recorder.spawn(2, false, sensors);
+		alive[1] = true;
+		alive[2] = false;
+
+		for (int tick = 0; tick < TICKS; tick++) {
+			if (tick == 6) {
+				recorder.spawn(3, false, sensors);
+				alive[3] = false;
+			}
+			if (tick == 7) {
+				recorder.despawn(2);
+				alive.erase(2);
+			}
+
+			map<int, Transform> transforms;
+			map<int, Vehicle_Attributes> attributes;
+			for (map<int, bool>::iterator it = alive.begin(); it != alive.end(); ++it) {
+				Transform& t = transforms[it->first];
+				Vehicle_Attributes& a = attributes[it->first];
+				replay_state(it->first, tick, t, a);
+
+				std::vector<int32_t>& q = expected[tick][it->first];
+				q.resize(replay::FIELD_COUNT);
+				q[replay::X] = static_cast<int32_t>(lroundf(t.position.x * replay::POSITION_SCALE));
+				q[replay::Z] = static_cast<int32_t>(lroundf(t.position.z * replay::POSITION_SCALE));
+				q[replay::HEADING] = static_cast<int32_t>(lroundf(t.rotation.y * replay::HEADING_SCALE));
+				q[replay::ENERGY] = static_cast<int32_t>(lroundf(a.energy * replay::ENERGY_SCALE));
+				q[replay::SPEED] = static_cast<int32_t>(lroundf(a.speed * replay::SPEED_SCALE));
+			}
+
+			recorder.record(tick, transforms, attributes);
+		}
+		recorder.destroy();
+
+		Replay_Player player;
+		check(player.init(filename), "replay player opens the recording");
+
+		if (player.is_open()) {
+			check(player.first_tick == 0 && player.last_tick == TICKS - 1, "replay covers ticks 0 to " + std::to_string(TICKS - 1));
+
+			// Played straight through, then sought into the middle of each stretch between keyframes
+			int decoded = 0;
+			do {
+				const map<int, std::vector<int32_t>>& e = expected[player.tick];
+				bool matches = player.tracks.size() == e.size();
+				for (map<int, Replay_Track>::iterator it = player.tracks.begin(); matches && it != player.tracks.end(); ++it)
+					matches = e.count(it->first) == 1 && std::equal(e.at(it->first).begin(), e.at(it->first).end(), it->second.value) &&
+						it->second.is_predator == (it->first == 1);
+
+				check(matches, "replay tick " + std::to_string(player.tick) + " decodes to the recorded values");
+				decoded++;
+			} while (player.step());
+			check(decoded == TICKS, "replay plays back all " + std::to_string(TICKS) + " ticks");
+
+			const int seeks[] = { 5, 2, 9, 4 };
+			for (int i = 0; i < 4; i++) {
+				bool sought = player.seek(seeks[i]) && player.tick == seeks[i];
+				const map<int, std::vector<int32_t>>& e = expected[seeks[i]];
+				bool matches = sought && player.tracks.size() == e.size();
+				for (map<int, Replay_Track>::iterator it = player.tracks.begin(); matches && it != player.tracks.end(); ++it)
+					matches = e.count(it->first) == 1 && std::equal(e.at(it->first).begin(), e.at(it->first).end(), it->second.value);
+
+				check(matches, "replay seek to tick " + std::to_string(seeks[i]) + " decodes to the recorded values");
+			}
+		}
+
+		player.destroy();
+		std::remove(filename);
+	}
+
+	// A restored world has to carry on exactly as the one that saved it, or resumed runs and branches go somewhere else
+	void test_checkpoint() {
+		const int TICKS = 300;
+
+		seed_random(1);
+
+		Simulation original;
+		original.run_headless(120);
+
+		std::vector<uint8_t> saved;
+		original.checkpoint(saved);
+
+		Simulation restored;
+		if (!restored.restore(saved.data(), saved.size())) {
+			check(false, "checkpoint restores");
+			original.destroy();
+			restored.destroy();
+			return;
+		}
+
+		// Both draw from the one random engine, so each is stepped with it where the other left it
+		std::ostringstream engine;
+		engine << random_engine();
+
+		int diverged = -1;
+		for (int i = 0; i < TICKS && diverged < 0; i++) {
+			std::istringstream original_engine(engine.str());
+			original_engine >> random_engine();
+			original.update();
+			uint64_t original_hash = original.state_hash();
+
+			std::istringstream restored_engine(engine.str());
+			restored_engine >> random_engine();
+			restored.update();
+
+			engine.str("");
+			engine << random_engine();
+
+			if (restored.state_hash() != original_hash)
+				diverged = i;
+		}
+		check(diverged < 0, "restored world diverges from the one that saved it " + std::to_string(diverged) + " ticks after the checkpoint");
+
+		original.destroy();
+		restored.destroy();
+	}
+
+	// A branch that changes nothing runs on a bare world and another thread, and still has to end where the parent does
+	void test_branch() {
+		const int TICKS = 120;
+
+		seed_random(2);
+
+		Simulation parent;
+		parent.run_headless(120);
+
+		std::vector<uint8_t> saved;
+		parent.checkpoint(saved);
+
+		std::vector<Branch> branches(1);
+		std::vector<Branch_Result> results;
+		Simulation::run_branches(saved, branches, TICKS, results);
+
+		parent.run_headless(TICKS);
+
+		check(results[0].restored, "branch restores the checkpoint");
+		check(results[0].tick == parent.tick && results[0].state_hash == parent.state_hash(), "unmodified branch ends at tick " +
+			std::to_string(results[0].tick) + " with hash " + hex(results[0].state_hash, 16) + ", parent at tick " + std::to_string(parent.tick) +
+			" with " + hex(parent.state_hash(), 16));
+
+		parent.destroy();
+	}
+
+	void test_pack_half() {
+		const float infinity = std::numeric_limits<float>::infinity();
+
+		struct Case {
+			float f;
+			uint16_t half;
+			const char* what;
+		};
+
+		const Case cases[] = {
+			{ 0.f, 0x0000, "zero" },
+			{ -0.f, 0x8000, "negative zero" },
+			{ 1.f, 0x3C00, "one" },
+			{ -2.f, 0xC000, "minus two" },
+			{ 1.f + ldexpf(1.f, -11), 0x3C00, "a tie below an even mantissa" },
+			{ 1.f + ldexpf(3.f, -11), 0x3C02, "a tie below an odd mantissa" },
+			{ 65504.f, 0x7BFF, "the largest finite half" },
+			{ 65519.f, 0x7BFF, "just below the rounding point to infinity" },
+			{ 65520.f, 0x7C00, "the rounding point to infinity" },
+			{ 1e10f, 0x7C00, "a float past half range" },
+			{ infinity, 0x7C00, "infinity" },
+			{ -infinity, 0xFC00, "negative infinity" },
+			{ ldexpf(1.f, -14), 0x0400, "the smallest normal half" },
+			{ ldexpf(1.f, -24), 0x0001, "the smallest subnormal half" },
+			{ -ldexpf(1.f, -24), 0x8001, "the smallest negative subnormal half" },
+			{ ldexpf(1.f, -15), 0x0200, "a subnormal half" },
+			{ ldexpf(3.f, -26), 0x0001, "a value rounding up to the smallest subnormal" },
+			{ ldexpf(1.f, -25), 0x0000, "a tie between zero and the smallest subnormal" },
+			{ ldexpf(3.f, -25), 0x0002, "a tie rounding up to an even subnormal" },
+			{ ldexpf(1.f, -14) - ldexpf(1.f, -26), 0x0400, "the largest subnormal rounding up into the normals" },
+			{ std::numeric_limits<float>::denorm_min(), 0x0000, "the smallest float subnormal" },
+			{ -std::numeric_limits<float>::denorm_min(), 0x8000, "the smallest negative float subnormal" },
+			{ std::numeric_limits<float>::min() * 0.5f, 0x0000, "a float subnormal" }
+		};
+
+		for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+			uint16_t half = pack_half(cases[i].f);
+			check(half == cases[i].half, std::string("pack_half of ") + cases[i].what + " gave " + hex(half, 4) + ", expected " + hex(cases[i].half, 4));
+		}
+
+		// Any mantissa will do, as long as it is not zero and so not infinity
+		const float nans[] = { std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::signaling_NaN() };
+		for (int i = 0; i < 3; i++) {
+			uint16_t half = pack_half(nans[i]);
+			check((half & 0x7C00) == 0x7C00 && (half & 0x03FF) != 0, "pack_half of NaN " + std::to_string(i) + " gave " + hex(half, 4) + ", not a NaN");
+		}
+	}
+}
+
+int run_self_test() {
+	failures = 0;
+
+	test_xxhash64();
+	test_replay();
+	test_checkpoint();
+	test_branch();
+	test_pack_half();
+
+	if (failures == 0)
+		std::cout << "Self test passed" << std::endl;
+	else
+		std::cout << failures << " self test checks failed" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}
@@ -1,4 +1,7 @@
 #include "..\include\shader.h"
+#include "..\include\utils.h"
+
+#include <cstring>
 
 namespace utils {
 	Shader::Shader() {
@@ -8,88 +11,180 @@ namespace utils {
 	}
 
 	Shader::Shader(const char* compute_shader_filename) {
-		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
-		std::string src = load_source(compute_shader_filename);
-		compile(computeShader, src.c_str());
-		
-		program = glCreateProgram();
-
-		glAttachShader(program, computeShader);
+		v_shader_filename = "";
+		f_shader_filename = "";
 
-		link();
-		use();
+		GLenum stages[] = { GL_COMPUTE_SHADER };
+		const char* filenames[] = { compute_shader_filename };
+		build(stages, filenames, 1);
 	}
 
 	Shader::Shader(const char* vertex_shader_filename, const char* fragment_shader_filename) {
 		v_shader_filename = vertex_shader_filename;
 		f_shader_filename = fragment_shader_filename;
 
-		GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-		std::string v_src = load_source(vertex_shader_filename);
-		compile(vertShader, v_src.c_str());
+		GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		const char* filenames[] = { vertex_shader_filename, fragment_shader_filename };
+		build(stages, filenames, 2);
+	}
 
-		GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-		std::string f_src = load_source(fragment_shader_filename);
-		compile(fragShader, f_src.c_str());
+	Shader::Shader(const char* vertex_shader_filename, const char* fragment_shader_filename, const char* geom_shader_filename) {
+		v_shader_filename = vertex_shader_filename;
+		f_shader_filename = fragment_shader_filename;
 
-		program = glCreateProgram();
+		GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		const char* filenames[] = { vertex_shader_filename, fragment_shader_filename, geom_shader_filename };
+		build(stages, filenames, 3);
+	}
 
-		glAttachShader(program, vertShader);
-		glAttachShader(program, fragShader);
+	Shader::Shader(const char* vertex_shader_filename, const char* tess_control_shader_filename, const char* tess_eval_shader_filename, const char* fragment_shader_filename) {
+		v_shader_filename = vertex_shader_filename;
+		f_shader_filename = fragment_shader_filename;
 
-		link();
-		use();
+		GLenum stages[] = { GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_FRAGMENT_SHADER };
+		const char* filenames[] = { vertex_shader_filename, tess_control_shader_filename, tess_eval_shader_filename, fragment_shader_filename };
+		build(stages, filenames, 4);
 	}
 
-	Shader::Shader(const char* vertex_shader_filename, const char* fragment_shader_filename, const char* geom_shader_filename) {
-		GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-		std::string v_src = load_source(vertex_shader_filename);
-		compile(vertShader, v_src.c_str());
+	namespace {
+		const char PROGRAM_CACHE_MAGIC[4] = { 'G', 'L', 'V', 'P' };
+		const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+		struct Program_Cache_Header {
+			char magic[4];
+			uint32_t version;
+			uint64_t hash;
+			uint32_t format;
+			uint32_t length;
+		};
+
+		uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
 
-		GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-		std::string f_src = load_source(fragment_shader_filename);
-		compile(fragShader, f_src.c_str());
+		uint64_t fnv1a(uint64_t hash, const char* str) {
+			return (str != nullptr) ? fnv1a(hash, str, strlen(str)) : hash;
+		}
 
-		GLuint geomShader = glCreateShader(GL_GEOMETRY_SHADER);
-		std::string g_src = load_source(geom_shader_filename);
-		compile(geomShader, g_src.c_str());
+		bool binaries_supported() {
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			return formats > 0;
+		}
+	}
+
+	void Shader::build(const GLenum* stages, const char* const* filenames, int count) {
+		std::string sources[4];
+
+		// Binaries are only valid for the exact driver that produced them, so it is part of the key
+		uint64_t hash = 14695981039346656037ull;
+		hash = fnv1a(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+		hash = fnv1a(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+		hash = fnv1a(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+
+		// Named after the stage files so each program keeps one cache file however often its source changes
+		std::string cache_filename = filenames[0];
+		for (int i = 0; i < count; i++) {
+			sources[i] = load_source(filenames[i]);
+			hash = fnv1a(hash, &stages[i], sizeof(GLenum));
+			hash = fnv1a(hash, sources[i].data(), sources[i].size());
+
+			if (i > 0) {
+				std::string name = filenames[i];
+				size_t slash = name.find_last_of("/\\");
+				cache_filename += "+" + ((slash == std::string::npos) ? name : name.substr(slash + 1));
+			}
+		}
+		cache_filename += ".bin";
+
+		bool cacheable = binaries_supported();
 
 		program = glCreateProgram();
+		if (cacheable && load_binary(cache_filename, hash)) {
+			use();
+			return;
+		}
+
+		GLuint shaders[4];
+		for (int i = 0; i < count; i++) {
+			shaders[i] = glCreateShader(stages[i]);
+			compile(shaders[i], sources[i].c_str());
+			glAttachShader(program, shaders[i]);
+		}
+
+		if (cacheable)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+		bool linked = link();
+
+		for (int i = 0; i < count; i++) {
+			glDetachShader(program, shaders[i]);
+			glDeleteShader(shaders[i]);
+		}
 
-		glAttachShader(program, vertShader);
-		glAttachShader(program, fragShader);
-		glAttachShader(program, geomShader);
+		if (linked && cacheable)
+			save_binary(cache_filename, hash);
 
-		link();
 		use();
 	}
 
-	Shader::Shader(const char* vertex_shader_filename, const char* tess_control_shader_filename, const char* tess_eval_shader_filename, const char* fragment_shader_filename) {
-		GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-		std::string v_src = load_source(vertex_shader_filename);
-		compile(vertShader, v_src.c_str());
+	bool Shader::load_binary(const std::string& cache_filename, uint64_t hash) {
+		std::ifstream ifs(cache_filename.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::ate);
+		if (!ifs)
+			return false;
 
-		GLuint tcShader = glCreateShader(GL_TESS_CONTROL_SHADER);
-		std::string tc_src = load_source(tess_control_shader_filename);
-		compile(tcShader, tc_src.c_str());
+		std::streamoff file_size = ifs.tellg();
+		ifs.seekg(0);
 
-		GLuint teShader = glCreateShader(GL_TESS_EVALUATION_SHADER);
-		std::string te_src = load_source(tess_eval_shader_filename);
-		compile(teShader, te_src.c_str());
+		Program_Cache_Header header;
+		if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return false;
 
-		GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-		std::string f_src = load_source(fragment_shader_filename);
-		compile(fragShader, f_src.c_str());
+		if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, 4) != 0 || header.version != PROGRAM_CACHE_VERSION || header.hash != hash)
+			return false;
 
-		program = glCreateProgram();
+		// A damaged length is caught before it becomes an allocation, and the program is compiled from source instead
+		if (header.length > file_size - static_cast<std::streamoff>(sizeof(header)))
+			return false;
 
-		glAttachShader(program, vertShader);
-		glAttachShader(program, tcShader);
-		glAttachShader(program, teShader);
-		glAttachShader(program, fragShader);
+		std::string binary(header.length, '\0');
+		if (!ifs.read(&binary[0], header.length))
+			return false;
 
-		link();
-		use();
+		// A driver update can still reject a matching binary, in which case the caller compiles from source
+		glProgramBinary(program, header.format, binary.data(), header.length);
+
+		GLint status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		return status == GL_TRUE;
+	}
+
+	void Shader::save_binary(const std::string& cache_filename, uint64_t hash) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		std::string binary(length, '\0');
+		GLenum format;
+		glGetProgramBinary(program, length, nullptr, &format, &binary[0]);
+
+		Program_Cache_Header header;
+		memcpy(header.magic, PROGRAM_CACHE_MAGIC, 4);
+		header.version = PROGRAM_CACHE_VERSION;
+		header.hash = hash;
+		header.format = format;
+		header.length = static_cast<uint32_t>(length);
+
+		std::ofstream ofs(temp_filename(cache_filename.c_str()).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		ofs.write(binary.data(), length);
+		commit_file(ofs, cache_filename.c_str());
 	}
 
 	void Shader::compile(GLuint shader, const char* src) {
@@ -104,7 +199,7 @@ namespace utils {
 		}
 	}
 
-	void Shader::link() {
+	bool Shader::link() {
 		GLint status;
 		GLchar infoLog[512];
 		glLinkProgram(program);
@@ -113,6 +208,8 @@ namespace utils {
 			glGetProgramInfoLog(program, 512, nullptr, infoLog);
 			std::cout << infoLog << std::endl;
 		}
+
+		return status == GL_TRUE;
 	}
 
 	void Shader::use() {
@@ -167,6 +264,11 @@ namespace utils {
 	}
 
 	std::string Shader::load_source(const char* filename) {
+		const char* data;
+		size_t size;
+		if (asset_pack.find(filename, data, size))
+			return std::string(data, size);
+
 		std::ifstream input{filename};
 		return std::string{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
 	}
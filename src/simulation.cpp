@@ -1,20 +1,39 @@
 #include "..\include\simulation.h"
 
-int Simulation::instance_id = 0;
+namespace {
+	const char* TEXTURE_FILES[] = { "data/wheel_texture.png", "data/floor.png" };
+	const char* MODEL_FILES[] = { "data/wheel.obj", "data/grid.obj" };
+	const char* FONT_FILE = "data/ShareTechMono-Regular.ttf";
 
-Simulation::Simulation() {
+	int font_pixel_size(const Camera& camera) {
+		return static_cast<int>(camera.resolution.x / 60.f);
+	}
+
+	typedef std::chrono::steady_clock Clock;
+}
+
+Simulation::Simulation() : Simulation(true) {
+}
+
+Simulation::Simulation(bool populate) {
 	index_state = 1;
 	generation = 0;
+	instance_id = 0;
+	tick = 0;
+	checkpoint_interval = 300;
 
 	mouse_pressed = false;
 	is_updating = false;
 	is_drawing = true;
+	has_context = false;
 	draw_sensors = true;
 	draw_sensor_outlines = true;
+	draw_profiler = false;
 
-	ui = UI(camera);
-	text_renderer = Text_Renderer(static_cast<int>(camera.resolution.x / 60.f), "data/OpenSans-Regular.ttf");
-
+	if (populate) {
+		ui = UI(camera);
+		text_renderer = Text_Renderer(font_pixel_size(camera), FONT_FILE);
+	}
 
 	// Constructor of Physics makes a ton of objects, but add_vehicle is doing this as well. Works if physics initialised before, but is wrong.
 	{
@@ -22,13 +41,18 @@ Simulation::Simulation() {
 		physics = new Physics(transforms_vehicles.size(), transforms_vehicles, attributes_vehicles);
 
 		// Init Vehicles
-		for (int i = 0; i < 10; i++) {
+		for (int i = 0; populate && i < 10; i++) {
 			bool is_predator = i % 2 == 0;
 			add_vehicle(is_predator);
 		}
 	}
 
-	attributes_wheels = vector<Wheel_Attributes>(4) = { { 315.f, 0.f },{ 225.f, 0.f },{ 45.f, 180.f },{ 135.f, 180.f } };
+	attributes_wheels = vector<Wheel_Attributes>(4) = {
+		{ 315.f,   0.f, 8.f, 4.f, vec3{ 1.f, 1.f, 1.5f } },
+		{ 225.f,   0.f, 8.f, 4.f, vec3{ 1.f, 1.f, 1.5f } },
+		{  45.f, 180.f, 8.f, 4.f, vec3{ 1.f, 1.f, 1.5f } },
+		{ 135.f, 180.f, 8.f, 4.f, vec3{ 1.f, 1.f, 1.5f } }
+	};
 
 	// Init Walls
 	transforms_walls = vector<Transform>(5);
@@ -53,159 +77,777 @@ Simulation::Simulation() {
 }
 
 void Simulation::init() {
-	wheel_texture.init("data/wheel_texture.png");
-	floor_texture.init("data/floor.png");
-
-	wheel_model.init("data/wheel.obj");
-	grid_model.init("data/grid.obj");
+	// File I/O and decoding for every asset runs on workers while the renderers build their shaders here,
+	// the GL uploads follow on this thread once the workers are joined
+	Texture* textures[] = { &wheel_texture, &floor_texture };
+	Texture_Data texture_data[2];
+	bool textures_decoded[2] = { false, false };
+
+	Model* models[] = { &wheel_model, &grid_model };
+	bool models_loaded[2] = { false, false };
+
+	vector<thread> workers;
+	for (int i = 0; i < 2; i++) {
+		workers.push_back(thread([&, i]() { textures_decoded[i] = Texture::decode(TEXTURE_FILES[i], texture_data[i]); }));
+		workers.push_back(thread([&, i]() { models_loaded[i] = models[i]->load(MODEL_FILES[i]); }));
+	}
+	workers.push_back(thread([this]() { text_renderer.rasterise(); }));
 
 	cube_renderer.init();
 	line_renderer.init();
 	quad_renderer.init();
-	text_renderer.init(camera.resolution);
 	circle_renderer.init();
 	model_renderer.init();
 	tri_renderer.init();
 
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	for (int i = 0; i < 2; i++) {
+		if (textures_decoded[i])
+			textures[i]->upload(texture_data[i]);
+
+		if (models_loaded[i])
+			models[i]->upload();
+	}
+
+	text_renderer.init(camera.resolution);
+	profiler.init();
+
 	inactivity_timer.init(transforms_vehicles);
+	has_context = true;
 }
 
-void Simulation::update() {
+bool Simulation::build_asset_pack(const char* filename) {
+	// Loading each asset writes its runtime cache when it is missing or stale, those caches are what get packed
+	vector<string> files;
+	vector<string> sources;
+
+	for (int i = 0; i < 2; i++) {
+		Model model;
+		model.load(MODEL_FILES[i]);
+		files.push_back(string(MODEL_FILES[i]) + ".cache");
+		sources.push_back(MODEL_FILES[i]);
+
+		Texture_Data data;
+		Texture::decode(TEXTURE_FILES[i], data);
+		files.push_back(string(TEXTURE_FILES[i]) + ".cache");
+		sources.push_back(TEXTURE_FILES[i]);
+	}
 
-	// Check collision events and remove/add any eligible vehicles
-	{
-		vector<int> remove_indices;
-		for (pair<VehicleData*, VehicleData*> e : vehicle_collision_events) {
-			if ((e.first->is_predator && !e.second->is_predator) || (!e.first->is_predator && e.second->is_predator)) {
-				int index = -1;
-				if (e.first->is_predator) {
-					attributes_vehicles[e.first->instance_id].energy = 100.f;
-					remove_indices.push_back( e.second->instance_id);
-				}
-				else {
-					attributes_vehicles[e.second->instance_id].energy = 100.f;
-					remove_indices.push_back(e.first->instance_id);
-				}
-			}
+	Camera camera;
+	Text_Renderer text(font_pixel_size(camera), FONT_FILE);
+	text.rasterise();
+	files.push_back(text.baked_filename());
+	sources.push_back(FONT_FILE);
+
+	// Shaders are packed as their own source
+	size_t shader_start = files.size();
+	Asset_Pack::list_files("shaders", ".glsl", files);
+	for (size_t i = shader_start; i < files.size(); i++)
+		sources.push_back(files[i]);
+
+	return Asset_Pack::build(filename, files, sources);
+}
+
+void Simulation::run_headless(int ticks) {
+	inactivity_timer.init(transforms_vehicles);
+	is_updating = true;
+
+	for (int i = 0; i < ticks; i++)
+		update();
+}
+
+bool Simulation::run_benchmark(int frames, const char* filename) {
+	// Shader warm up and first uploads stay out of the numbers
+	const int WARMUP_FRAMES = 30;
+
+	if (frames <= 0) {
+		std::cout << "A benchmark needs at least one frame" << std::endl;
+		return false;
+	}
+
+	std::ofstream ofs(filename, std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to open benchmark report " << filename << std::endl;
+		return false;
+	}
+
+	Offscreen_Target target;
+	if (!target.init(static_cast<int>(camera.resolution.x), static_cast<int>(camera.resolution.y)))
+		return false;
+
+	is_drawing = true;
+	camera.follow_vehicle = false;
+
+	Rolling_Samples frame_ms(frames);
+	double frame_ms_sum = 0.0;
+	double draw_calls = 0.0;
+	double triangles = 0.0;
+	double gpu_ms = 0.0;
+	int gpu_frames = 0;
+
+	Clock::time_point last = Clock::now();
+	for (int frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		// One orbit over the measured frames, gliding between the orbit points
+		float path = (std::max(frame, 0) * static_cast<float>(camera.list_position_current.size())) / frames;
+		camera.index_list_position_current = static_cast<int>(path) % camera.list_position_current.size();
+		camera.path_blend = path - floorf(path);
+
+		// The world settles during warm up and is frozen for the measured frames, so only rendering is timed. update still
+		// runs for the camera, but with is_updating off it neither steps physics nor advances a replay
+		is_updating = frame < 0;
+
+		target.bind();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		update();
+		draw();
+
+		// Nothing is presented, so without waiting each frame would only time how fast commands are queued
+		glFinish();
+
+		Clock::time_point now = Clock::now();
+		float ms = std::chrono::duration<float, std::milli>(now - last).count();
+		last = now;
+
+		if (frame < 0)
+			continue;
+
+		frame_ms.add(ms);
+		frame_ms_sum += ms;
+		draw_calls += profiler.draw_calls;
+		triangles += static_cast<double>(profiler.triangles);
+		if (profiler.gpu_sample_ready) {
+			for (int i = 0; i < Profiler::PASS_COUNT; i++)
+				gpu_ms += profiler.gpu_pass_sample[i];
+			gpu_frames++;
 		}
+	}
 
-		vehicle_collision_events.clear();
+	// Software and hardware GL give very different numbers, so the report says which one produced them
+	ofs << "renderer," << glGetString(GL_RENDERER) << "\n";
+	ofs << "version," << glGetString(GL_VERSION) << "\n";
+	ofs << "frames," << frames << "\n";
+	ofs << "ticks," << tick << "\n";
+	ofs << "frame_ms_mean," << frame_ms_sum / frames << "\n";
+	ofs << "frame_ms_p50," << frame_ms.percentile(0.5f) << "\n";
+	ofs << "frame_ms_p95," << frame_ms.percentile(0.95f) << "\n";
+	ofs << "frame_ms_p99," << frame_ms.percentile(0.99f) << "\n";
+	ofs << "frame_ms_max," << frame_ms.percentile(1.f) << "\n";
+	ofs << "gpu_ms_mean," << ((gpu_frames > 0) ? gpu_ms / gpu_frames : 0.0) << "\n";
+	ofs << "draw_calls_mean," << draw_calls / frames << "\n";
+	ofs << "triangles_mean," << triangles / frames << "\n";
+
+	std::cout << "Benchmark on " << glGetString(GL_RENDERER) << ": " << frames << " frames, mean " << frame_ms_sum / frames << " ms, p99 " << frame_ms.percentile(0.99f) << " ms" << std::endl;
+
+	target.destroy();
+	return true;
+}
 
-		for (uint8 i = 0; i < remove_indices.size(); i++) {
-			bool is_predator = true;
-			if (attributes_vehicles[remove_indices[i]].is_predator)
-				is_predator = false;
+bool Simulation::run_capture(int frames, const char* filename) {
+	Video_Capture capture;
+	if (!capture.init(filename, static_cast<int>(camera.resolution.x), static_cast<int>(camera.resolution.y)))
+		return false;
 
-			remove_vehicle(remove_indices[i]);
-			add_vehicle(is_predator);
+	is_updating = true;
+	is_drawing = true;
+
+	for (int frame = 0; frame < frames; frame++) {
+		capture.begin_frame();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		update();
+		draw();
+		capture.end_frame();
+	}
+
+	capture.destroy();
+	return true;
+}
+
+bool Simulation::start_recording(const char* filename) {
+	if (!recorder.init(filename))
+		return false;
+
+	// Vehicles that already exist are announced as spawns so the recording is self-contained
+	for (map<int, Vehicle_Attributes>::iterator it = attributes_vehicles.begin(); it != attributes_vehicles.end(); ++it)
+		recorder.spawn(it->first, it->second.is_predator, vehicle_sensors[it->first]);
+
+	return true;
+}
+
+bool Simulation::load_replay(const char* filename) {
+	if (!player.init(filename))
+		return false;
+
+	physics->destroy();
+	delete physics;
+	physics = nullptr;
+
+	transforms_vehicles.clear();
+	attributes_vehicles.clear();
+	vehicle_sensors.clear();
+	lights.clear();
+
+	update_from_replay();
+	is_updating = true;
+	return true;
+}
+
+void Simulation::seek_replay(int ticks) {
+	if (!player.is_open())
+		return;
+
+	player.seek(min(max(player.tick + ticks, player.first_tick), player.last_tick));
+	update_from_replay();
+}
+
+void Simulation::update_from_replay() {
+	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end();) {
+		int id = it->first;
+		if (player.tracks.find(id) == player.tracks.end()) {
+			attributes_vehicles.erase(id);
+			vehicle_sensors.erase(id);
+			lights.erase(id);
+			it = transforms_vehicles.erase(it);
+		}
+		else {
+			++it;
 		}
 	}
 
+	for (map<int, Replay_Track>::iterator it = player.tracks.begin(); it != player.tracks.end(); ++it) {
+		int id = it->first;
+		const Replay_Track& r = it->second;
+
+		if (transforms_vehicles.find(id) == transforms_vehicles.end())
+			transforms_vehicles.insert(pair<int, Transform>(id, { vec3{ 0.f, 4.f, 0.f }, vec3{ 20.f, 2.f, 16.f }, vec3{ 0.f } }));
+
+		// Reapplied every tick, an id can be reused by a new vehicle within a single tick
+		vec4 colour = (r.is_predator) ? utils::colour::red : utils::colour::blue;
+		attributes_vehicles[id] = { 0.f, 0.f, colour, r.is_predator, r.value[replay::ENERGY] / replay::ENERGY_SCALE, id, r.value[replay::SPEED] / replay::SPEED_SCALE };
+		lights[id].colour = colour.XYZ();
+
+		Vehicle_Sensors& sensors = vehicle_sensors[id];
+		sensors.angle = r.sensor_angle;
+		sensors.offset = r.sensor_offset;
+		sensors.range = r.sensor_range;
+
+		Transform& t = transforms_vehicles[id];
+		t.position.x = r.value[replay::X] / replay::POSITION_SCALE;
+		t.position.z = r.value[replay::Z] / replay::POSITION_SCALE;
+		t.rotation.y = r.value[replay::HEADING] / replay::HEADING_SCALE;
+	}
+
+	update_sensors_from_simulation_transforms();
+	stats.recount(attributes_vehicles);
+	tick = player.tick;
+
+	if (transforms_vehicles.empty())
+		camera.follow_vehicle = false;
+}
+
+void Simulation::update() {
+	if (player.is_open()) {
+		if (is_updating) {
+			if (player.step())
+				update_from_replay();
+			else
+				is_updating = false;
+		}
+	}
+	else {
+		Clock::time_point start = Clock::now();
+		resolve_catches();
+		metrics.record_phase(Metrics::PHASE_RESPAWN, Clock::now() - start);
+
+		if (is_updating)
+			step();
+	}
+
 	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end(); ++it) {
 		lights[it->first].position = it->second.position;
 		lights[it->first].intensity = attributes_vehicles[it->first].energy * 0.01f;
 	}
 
-	if (is_updating) {
-		// Update Physics
-		physics->update();
+	ui.update(cursor_position, mouse_pressed);
+	camera.update(transforms_vehicles);
+
+	mouse_pressed = false;
+}
+
+// Check collision events and remove/add any eligible vehicles
+void Simulation::resolve_catches() {
+	vector<int> remove_indices;
+	for (const pair<VehicleData, VehicleData>& e : physics->collision_events) {
+		if ((e.first.is_predator && !e.second.is_predator) || (!e.first.is_predator && e.second.is_predator)) {
+			int index = -1;
+			if (e.first.is_predator) {
+				attributes_vehicles[e.first.instance_id].energy = 100.f;
+				remove_indices.push_back( e.second.instance_id);
+				recorder.caught(e.first.instance_id, e.second.instance_id);
+				stats.caught();
+				metrics.catches++;
+			}
+			else {
+				attributes_vehicles[e.second.instance_id].energy = 100.f;
+				remove_indices.push_back(e.first.instance_id);
+				recorder.caught(e.second.instance_id, e.first.instance_id);
+				stats.caught();
+				metrics.catches++;
+			}
+		}
+	}
+
+	physics->collision_events.clear();
 
-		// Vehicles Transforms
-		old_transforms_vehicles = transforms_vehicles;
-		update_simulation_transforms_from_physics();
-		update_sensors_from_simulation_transforms();
+	for (uint8 i = 0; i < remove_indices.size(); i++) {
+		bool is_predator = true;
+		if (attributes_vehicles[remove_indices[i]].is_predator)
+			is_predator = false;
 
-		check_detected_vehicles();
-		//check_detected_walls();
-		predator_prey();
+		remove_vehicle(remove_indices[i]);
+		add_vehicle(is_predator);
+	}
+	metrics.respawns += remove_indices.size();
+}
 
-		vector<int> remove_ids;
-		for (map<int, Vehicle_Attributes>::iterator it = attributes_vehicles.begin(); it != attributes_vehicles.end(); ++it) {
-			Vehicle_Attributes& tmp = it->second;
+void Simulation::step() {
+	Clock::time_point tick_start = Clock::now();
+	tick++;
 
-			if (!almost_equal(transforms_vehicles[it->first].position.XZ(), old_transforms_vehicles[it->first].position.XZ(), 1.f)) {
-				tmp.energy -= 0.15f;
-			}
+	// Update Physics
+	physics->update();
+	stats.observe_physics(physics->profile);
 
-			tmp.energy -= (tmp.is_predator) ? 0.1f : 0.05f;
+	Clock::time_point phase_start = Clock::now();
+	metrics.record_phase(Metrics::PHASE_PHYSICS, phase_start - tick_start);
 
-			if (tmp.energy < 0.f) {
-				remove_ids.push_back(it->first);
-			}
+	// Vehicles Transforms
+	old_transforms_vehicles = transforms_vehicles;
+	update_simulation_transforms_from_physics();
+	update_sensors_from_simulation_transforms();
+
+	check_detected_vehicles();
+	//check_detected_walls();
+	predator_prey();
+
+	Clock::time_point phase_end = Clock::now();
+	metrics.record_phase(Metrics::PHASE_SENSORS, phase_end - phase_start);
+	phase_start = phase_end;
+
+	vector<int> remove_ids;
+	for (map<int, Vehicle_Attributes>::iterator it = attributes_vehicles.begin(); it != attributes_vehicles.end(); ++it) {
+		Vehicle_Attributes& tmp = it->second;
+
+		if (!almost_equal(transforms_vehicles[it->first].position.XZ(), old_transforms_vehicles[it->first].position.XZ(), 1.f)) {
+			tmp.energy -= 0.15f;
 		}
 
-		for (uint8 i = 0; i < remove_ids.size(); i++) {
-			bool is_predator = true;
-			if (attributes_vehicles[remove_ids[i]].is_predator)
-				is_predator = false;
-			remove_vehicle(remove_ids[i]);
-			add_vehicle(is_predator);
+		tmp.energy -= (tmp.is_predator) ? 0.1f : 0.05f;
+		stats.observe(tmp.energy, tmp.speed);
+
+		if (tmp.energy < 0.f) {
+			remove_ids.push_back(it->first);
 		}
-		
+	}
 
-		if (transforms_vehicles.size() >= 2) {
-			inactivity_timer.update(transforms_vehicles);
-			if (inactivity_timer.remaining_milliseconds < 0.f) {
-				reset();
-				is_updating = true;
-			}
+	for (uint8 i = 0; i < remove_ids.size(); i++) {
+		bool is_predator = true;
+		if (attributes_vehicles[remove_ids[i]].is_predator)
+			is_predator = false;
+		remove_vehicle(remove_ids[i]);
+		add_vehicle(is_predator);
+	}
+	metrics.respawns += remove_ids.size();
+	
+
+	if (transforms_vehicles.size() >= 2) {
+		inactivity_timer.update(transforms_vehicles);
+		if (inactivity_timer.remaining_milliseconds < 0.f) {
+			reset();
+			is_updating = true;
 		}
 	}
 
-	ui.update(cursor_position, mouse_pressed);
-	camera.update(transforms_vehicles);
+	phase_end = Clock::now();
+	metrics.record_phase(Metrics::PHASE_RESPAWN, phase_end - phase_start);
+	phase_start = phase_end;
 
-	mouse_pressed = false;
+	recorder.record(tick, transforms_vehicles, attributes_vehicles);
+
+	if (!checkpoint_filename.empty() && tick % checkpoint_interval == 0)
+		save_checkpoint(checkpoint_filename.c_str());
+
+	if (hash_log.is_open())
+		hash_log.write(tick, state_hash());
+
+	stats.end_tick(tick, generation);
+
+	metrics.predators.store(stats.predators, std::memory_order_relaxed);
+	metrics.prey.store(stats.prey, std::memory_order_relaxed);
+	metrics.contacts.store(physics->profile.contacts, std::memory_order_relaxed);
+
+	phase_end = Clock::now();
+	metrics.record_phase(Metrics::PHASE_OUTPUT, phase_end - phase_start);
+	metrics.record_tick(phase_end - tick_start);
+}
+
+uint64_t Simulation::state_hash() {
+	// Quantised so the log follows the state the simulation acts on rather than the last bits of every float
+	vector<int32_t> state;
+	state.reserve(transforms_vehicles.size() * 9);
+
+	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end(); ++it) {
+		const Vehicle_Attributes& a = attributes_vehicles[it->first];
+		b2Body* body = physics->vehicles[it->first].body;
+
+		state.push_back(it->first);
+		state.push_back(a.is_predator);
+		state.push_back(lroundf(it->second.position.x * 1024.f));
+		state.push_back(lroundf(it->second.position.z * 1024.f));
+		state.push_back(lroundf(it->second.rotation.y * 1024.f));
+		state.push_back(lroundf(body->GetLinearVelocity().x * 1024.f));
+		state.push_back(lroundf(body->GetLinearVelocity().y * 1024.f));
+		state.push_back(lroundf(body->GetAngularVelocity() * 1024.f));
+		state.push_back(lroundf(a.energy * 1024.f));
+	}
+
+	return xxhash64(state.data(), state.size() * sizeof(int32_t));
+}
+
+namespace {
+	const char CHECKPOINT_MAGIC[4] = { 'G', 'L', 'V', 'C' };
+	const uint32_t CHECKPOINT_VERSION = 2;
+
+	bool same_vehicle(const Vehicle_Attributes& a, const Vehicle_Sensors& as, const Vehicle_Attributes& b, const Vehicle_Sensors& bs) {
+		return a.is_predator == b.is_predator && as.angle == bs.angle && as.offset == bs.offset && as.range == bs.range;
+	}
+}
+
+void Simulation::checkpoint(std::vector<uint8_t>& bytes) {
+	Checkpoint_Writer w;
+	w.write(CHECKPOINT_MAGIC);
+	w.write(CHECKPOINT_VERSION);
+
+	w.write(tick);
+	w.write(generation);
+	w.write(instance_id);
+	w.write(is_updating);
+
+	std::ostringstream rng;
+	rng << random_engine();
+	w.write_string(rng.str());
+
+	w.write(inactivity_timer.start_milliseconds);
+	w.write(inactivity_timer.remaining_milliseconds);
+	w.write(static_cast<uint32_t>(inactivity_timer.old_transforms.size()));
+	for (map<int, Transform>::iterator it = inactivity_timer.old_transforms.begin(); it != inactivity_timer.old_transforms.end(); ++it) {
+		w.write(it->first);
+		w.write(it->second);
+	}
+
+	w.write(static_cast<uint32_t>(transforms_vehicles.size()));
+	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end(); ++it) {
+		const Vehicle_Attributes& a = attributes_vehicles[it->first];
+		const Vehicle_Sensors& s = vehicle_sensors[it->first];
+
+		w.write(it->first);
+		w.write(it->second);
+
+		w.write(a.forward_speed);
+		w.write(a.turning_speed);
+		w.write(a.colour);
+		w.write(a.is_predator);
+		w.write(a.energy);
+		w.write(a.speed);
+
+		w.write(s.la);
+		w.write(s.lb);
+		w.write(s.lc);
+		w.write(s.ra);
+		w.write(s.rb);
+		w.write(s.rc);
+		w.write(s.angle);
+		w.write(s.offset);
+		w.write(s.range);
+	}
+
+	w.write(static_cast<uint32_t>(physics->collision_events.size()));
+	for (const pair<VehicleData, VehicleData>& e : physics->collision_events) {
+		w.write(e.first.instance_id);
+		w.write(e.first.is_predator);
+		w.write(e.second.instance_id);
+		w.write(e.second.is_predator);
+	}
+
+	physics->save(w);
+
+	// Box2D keeps warm starting impulses, sleep timers and contact order where they cannot be saved, so a restored world would
+	// drift from this one. Rebuilding this world from the same bytes every time, not just when something is watching, means a
+	// resumed run, a branch and this run all carry on from an identical state
+	restore(w.bytes.data(), w.bytes.size());
+	bytes.swap(w.bytes);
+}
+
+bool Simulation::restore(const uint8_t* data, size_t size) {
+	Checkpoint_Reader r(data, size);
+
+	char magic[4];
+	r.read(magic);
+	if (!r.ok || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0 || r.read<uint32_t>() != CHECKPOINT_VERSION) {
+		std::cout << "Not a compatible checkpoint" << std::endl;
+		return false;
+	}
+
+	int restored_tick = r.read<int>();
+	int restored_generation = r.read<int>();
+	int restored_instance_id = r.read<int>();
+	bool restored_is_updating = r.read<bool>();
+	std::string rng = r.read_string();
+
+	Inactivity_Timer timer;
+	timer.start_milliseconds = r.read<float>();
+	timer.remaining_milliseconds = r.read<float>();
+	uint32_t count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && r.ok; i++) {
+		int id = r.read<int>();
+		timer.old_transforms[id] = r.read<Transform>();
+	}
+
+	map<int, Transform> transforms;
+	map<int, Vehicle_Attributes> attributes;
+	map<int, Vehicle_Sensors> sensors;
+	count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && r.ok; i++) {
+		int id = r.read<int>();
+		transforms[id] = r.read<Transform>();
+
+		Vehicle_Attributes& a = attributes[id];
+		a.id = id;
+		r.read(a.forward_speed);
+		r.read(a.turning_speed);
+		r.read(a.colour);
+		r.read(a.is_predator);
+		r.read(a.energy);
+		r.read(a.speed);
+
+		Vehicle_Sensors& s = sensors[id];
+		r.read(s.la);
+		r.read(s.lb);
+		r.read(s.lc);
+		r.read(s.ra);
+		r.read(s.rb);
+		r.read(s.rc);
+		r.read(s.angle);
+		r.read(s.offset);
+		r.read(s.range);
+	}
+
+	Collision_Events collision_events;
+	count = r.read<uint32_t>();
+	for (uint32_t i = 0; i < count && r.ok; i++) {
+		VehicleData a, b;
+		r.read(a.instance_id);
+		r.read(a.is_predator);
+		r.read(b.instance_id);
+		r.read(b.is_predator);
+		collision_events.insert(pair<VehicleData, VehicleData>(a, b));
+	}
+
+	if (!r.ok || physics == nullptr) {
+		std::cout << "Checkpoint is truncated" << std::endl;
+		return false;
+	}
+
+	// A fresh world with only the walls, the vehicles are then rebuilt into it in their original order
+	map<int, Transform> no_transforms;
+	map<int, Vehicle_Attributes> no_attributes;
+	Physics* restored = new Physics(0, no_transforms, no_attributes);
+	if (!restored->restore(r)) {
+		std::cout << "Checkpoint is truncated" << std::endl;
+		restored->destroy();
+		delete restored;
+		return false;
+	}
+
+	physics->destroy();
+	delete physics;
+	physics = restored;
+
+	// The recording only hears about vehicles that differ from the ones it already tracks
+	for (map<int, Vehicle_Attributes>::iterator it = attributes_vehicles.begin(); it != attributes_vehicles.end(); ++it) {
+		if (attributes.find(it->first) == attributes.end() || !same_vehicle(it->second, vehicle_sensors[it->first], attributes[it->first], sensors[it->first]))
+			recorder.despawn(it->first);
+	}
+	for (map<int, Vehicle_Attributes>::iterator it = attributes.begin(); it != attributes.end(); ++it) {
+		if (attributes_vehicles.find(it->first) == attributes_vehicles.end() || !same_vehicle(it->second, sensors[it->first], attributes_vehicles[it->first], vehicle_sensors[it->first]))
+			recorder.spawn(it->first, it->second.is_predator, sensors[it->first]);
+	}
+
+	tick = restored_tick;
+	generation = restored_generation;
+	instance_id = restored_instance_id;
+	is_updating = restored_is_updating;
+
+	std::istringstream rng_state(rng);
+	rng_state >> random_engine();
+
+	inactivity_timer = timer;
+	transforms_vehicles.swap(transforms);
+	attributes_vehicles.swap(attributes);
+	vehicle_sensors.swap(sensors);
+	physics->collision_events.swap(collision_events);
+	stats.recount(attributes_vehicles);
+
+	lights.clear();
+	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end(); ++it) {
+		Vehicle_Attributes& a = attributes_vehicles[it->first];
+		lights.insert(pair<int, Light>(it->first, { it->second.position, a.colour.XYZ(), a.energy * 0.01f }));
+	}
+
+	if (transforms_vehicles.empty())
+		camera.follow_vehicle = false;
+
+	return true;
+}
+
+bool Simulation::save_checkpoint(const char* filename) {
+	if (physics == nullptr)
+		return false;
+
+	std::vector<uint8_t> bytes;
+	checkpoint(bytes);
+
+	// Written aside and swapped in, so a crash mid-write leaves the previous checkpoint intact
+	std::ofstream ofs(temp_filename(filename).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	ofs.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	return commit_file(ofs, filename);
+}
+
+void Simulation::run_branches(const std::vector<uint8_t>& checkpoint, const std::vector<Branch>& branches, int ticks, std::vector<Branch_Result>& results) {
+	results.assign(branches.size(), Branch_Result());
+
+	// Branches are handed out to one worker per core, the copy of the world is just the checkpoint bytes
+	std::atomic<size_t> next_branch(0);
+	size_t worker_count = min(branches.size(), static_cast<size_t>(max(thread::hardware_concurrency(), 1u)));
+
+	vector<thread> workers;
+	for (size_t w = 0; w < worker_count; w++) {
+		workers.push_back(thread([&]() {
+			for (size_t i = next_branch++; i < branches.size(); i = next_branch++) {
+				// Built on this thread, so restoring sets the random engine this branch goes on to draw from
+				Simulation branch(false);
+				Branch_Result& result = results[i];
+
+				result.restored = branch.restore(checkpoint.data(), checkpoint.size());
+				if (result.restored) {
+					branch.apply_branch(branches[i]);
+					branch.run_headless(ticks);
+
+					result.tick = branch.tick;
+					result.generation = branch.generation;
+					result.catches = branch.stats.catches;
+					result.state_hash = branch.state_hash();
+					for (map<int, Vehicle_Attributes>::iterator it = branch.attributes_vehicles.begin(); it != branch.attributes_vehicles.end(); ++it) {
+						it->second.is_predator ? result.predators++ : result.prey++;
+						result.mean_energy += it->second.energy;
+					}
+					if (!branch.attributes_vehicles.empty())
+						result.mean_energy /= branch.attributes_vehicles.size();
+				}
+
+				branch.destroy();
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void Simulation::apply_branch(const Branch& branch) {
+	if (branch.seed != 0)
+		seed_random(branch.seed);
+
+	for (map<int, Vehicle_Sensors>::iterator it = vehicle_sensors.begin(); it != vehicle_sensors.end(); ++it)
+		it->second.range *= branch.sensor_range_scale;
+
+	for (int i = 0; i < branch.extra_predators; i++)
+		add_vehicle(true);
+	for (int i = 0; i < branch.extra_prey; i++)
+		add_vehicle(false);
+}
+
+bool Simulation::load_checkpoint(const char* filename) {
+	Mapped_File file;
+	if (!file.init(filename))
+		return false;
+
+	return restore(reinterpret_cast<const uint8_t*>(file.data), file.size);
 }
 
 void Simulation::draw() {
 	if (is_drawing) {
+		profiler.begin_frame();
+
 		glEnable(GL_DEPTH_TEST);
 		{
 			// Walls & Floor
+			profiler.begin_pass(Profiler::PASS_WALLS);
 			model_renderer.draw_multiple_3D_textured(transforms_walls.size(), grid_model, camera, transforms_walls, floor_texture, lights);
+			profiler.end_pass(Profiler::PASS_WALLS);
 
 			// Boundaries
+			profiler.begin_pass(Profiler::PASS_BOUNDARIES);
 			vec4 c = { 0.2f, 0.3f, 0.2f, 1.f };
 			quad_renderer.draw_multiple_3D_coloured(camera, transforms_boundaries, c);
+			profiler.end_pass(Profiler::PASS_BOUNDARIES);
 
-			if (!transforms_vehicles.empty()) {
-				// Vehicles
-				cube_renderer.draw_multiple(camera, transforms_vehicles, attributes_vehicles, lights);
+			cull_vehicles();
 
-				// Wheels
-				model_renderer.draw_multiple_3D_textured(transforms_wheels.size(), wheel_model, camera, transforms_wheels, wheel_texture, lights);
-			}
+			// Vehicles
+			profiler.begin_pass(Profiler::PASS_BODIES);
+			if (!visible_vehicles.empty())
+				cube_renderer.draw_multiple(camera, transforms_vehicles, attributes_vehicles, visible_vehicles, lights);
+			profiler.end_pass(Profiler::PASS_BODIES);
+
+			// Wheels
+			profiler.begin_pass(Profiler::PASS_WHEELS);
+			if (!visible_vehicles.empty())
+				model_renderer.draw_wheels_3D_textured(wheel_model, camera, transforms_vehicles, attributes_vehicles, visible_vehicles, attributes_wheels, wheel_texture, lights);
+			profiler.end_pass(Profiler::PASS_WHEELS);
 		}
 
 	
 		glEnable(GL_BLEND);
 		{
-			if (!transforms_vehicles.empty()) {
-				// Vehicle Sensors
-				for (map<int, Vehicle_Sensors>::iterator it = vehicle_sensors.begin(); it != vehicle_sensors.end(); ++it) {
+			// Vehicle Sensors
+			profiler.begin_pass(Profiler::PASS_SENSORS);
+			for (size_t i = 0; i < visible_sensors.size(); i++) {
+				int id = visible_sensors[i];
 
-					float alpha = ((attributes_vehicles[it->first].energy * 0.1f) * 0.01f);
+				float alpha = ((attributes_vehicles[id].energy * 0.1f) * 0.01f);
 
-					Vehicle_Sensors& tmp = it->second;
+				Vehicle_Sensors& tmp = vehicle_sensors[id];
 
-					if (draw_sensors) {
-						tri_renderer.draw_3D_coloured(camera, tmp.la, tmp.lb, tmp.lc, vec4{ attributes_vehicles[it->first].colour.XYZ(), alpha });
-						tri_renderer.draw_3D_coloured(camera, tmp.ra, tmp.rb, tmp.rc, vec4{ attributes_vehicles[it->first].colour.XYZ(), alpha });
-					}
+				if (draw_sensors) {
+					tri_renderer.draw_3D_coloured(camera, tmp.la, tmp.lb, tmp.lc, vec4{ attributes_vehicles[id].colour.XYZ(), alpha });
+					tri_renderer.draw_3D_coloured(camera, tmp.ra, tmp.rb, tmp.rc, vec4{ attributes_vehicles[id].colour.XYZ(), alpha });
+				}
 
-					float l_alpha = alpha * 5.f;
-					if (draw_sensor_outlines) {
-						line_renderer.draw_lineloop(camera, { tmp.la, tmp.lb, tmp.lc, }, vec4{ attributes_vehicles[it->first].colour.XYZ(), l_alpha });
-						line_renderer.draw_lineloop(camera, { tmp.ra, tmp.rb, tmp.rc, }, vec4{ attributes_vehicles[it->first].colour.XYZ(), l_alpha });
-					}
+				float l_alpha = alpha * 5.f;
+				if (draw_sensor_outlines) {
+					line_renderer.draw_lineloop(camera, { tmp.la, tmp.lb, tmp.lc, }, vec4{ attributes_vehicles[id].colour.XYZ(), l_alpha });
+					line_renderer.draw_lineloop(camera, { tmp.ra, tmp.rb, tmp.rc, }, vec4{ attributes_vehicles[id].colour.XYZ(), l_alpha });
 				}
 			}
+			profiler.end_pass(Profiler::PASS_SENSORS);
 		}
 
 		glDisable(GL_DEPTH_TEST);
 		{
 			// UI
+			profiler.begin_pass(Profiler::PASS_UI);
 			if (ui.index_active_button != -1)
 				quad_renderer.draw_2D(camera, ui.attributes_ui[ui.index_active_button].position, ui.attributes_ui[ui.index_active_button].size * 1.1f, utils::colour::yellow);
 			for (size_t i = 0; i < ui.attributes_ui.size(); i++) {
@@ -214,11 +856,8 @@ void Simulation::draw() {
 				text_renderer.draw(tmp.label, tmp.position + vec2{ 0.f, -10.f }, true, colour::white);
 			}
 
-			int num_predators = 0;
-			int num_prey = 0;
-			for (map<int, Vehicle_Attributes>::iterator it = attributes_vehicles.begin(); it != attributes_vehicles.end(); ++it) {
-				attributes_vehicles[it->first].is_predator ? num_predators++ : num_prey++;
-			}
+			int num_predators = stats.predators;
+			int num_prey = stats.prey;
 
 			// Side Menu
 			{
@@ -259,35 +898,125 @@ void Simulation::draw() {
 					}
 				}
 
-				// Draw progress of inactivity tracker
+				// Draw progress of inactivity tracker, or of the recording when one is playing
 				y_offset_multiplier++;
-				string str_timer = (friendly_float(inactivity_timer.remaining_milliseconds, 4));
-				text_renderer.draw("INACTIVITY TRACKER", { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::yellow);
-				text_renderer.draw("Remaining: " + str_timer, { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::white);
+				if (player.is_open()) {
+					string str_tick = to_string(player.tick) + "/" + to_string(player.last_tick);
+					text_renderer.draw("REPLAY", { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::yellow);
+					text_renderer.draw("Tick: " + str_tick, { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::white);
+				}
+				else {
+					string str_timer = (friendly_float(inactivity_timer.remaining_milliseconds, 4));
+					text_renderer.draw("INACTIVITY TRACKER", { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::yellow);
+					text_renderer.draw("Remaining: " + str_timer, { text_x, text_y - (text_y_offset * y_offset_multiplier++) }, false, utils::colour::white);
+				}
+			}
+
+			// Physics Menu, what the last Box2D step spent its time on
+			if (physics != nullptr) {
+				const Physics_Profile& p = physics->profile;
+				float text_x = camera.resolution.x * 0.79685212298f;
+				float text_y = camera.resolution.y * 0.85f;
+				float text_y_offset = 30.f;
+
+				quad_renderer.draw_2D(camera, { camera.resolution.x * 0.875f, text_y - (text_y_offset * 3.f) }, { camera.resolution.x * 0.2f, text_y_offset * 9.f }, { 0.f, 0.f, 0.f, 0.7f });
+				string step =     "Step/Solve: " + friendly_float(p.step, 4) + "/" + friendly_float(p.solve, 4);
+				string collide =  "Coll/Broad: " + friendly_float(p.collide, 4) + "/" + friendly_float(p.broadphase, 4);
+				string toi =      "Solve TOI:  " + friendly_float(p.solve_toi, 4);
+				string bodies =   "Awake/Body: " + to_string(p.awake_bodies) + "/" + to_string(p.bodies);
+				string contacts = "Touch/All:  " + to_string(p.touching_contacts) + "/" + to_string(p.contacts);
+				string begins =   "Begin/Jnt:  " + to_string(p.begin_contacts) + "/" + to_string(p.joints);
+				text_renderer.draw("PHYSICS MS",	{ text_x, text_y - (text_y_offset * 0.f) }, false, utils::colour::yellow);
+				text_renderer.draw(step,			{ text_x, text_y - (text_y_offset * 1.f) }, false, utils::colour::white);
+				text_renderer.draw(collide,			{ text_x, text_y - (text_y_offset * 2.f) }, false, utils::colour::white);
+				text_renderer.draw(toi,				{ text_x, text_y - (text_y_offset * 3.f) }, false, utils::colour::white);
+				text_renderer.draw(bodies,			{ text_x, text_y - (text_y_offset * 4.f) }, false, utils::colour::white);
+				text_renderer.draw(contacts,		{ text_x, text_y - (text_y_offset * 5.f) }, false, utils::colour::white);
+				text_renderer.draw(begins,			{ text_x, text_y - (text_y_offset * 6.f) }, false, utils::colour::white);
 			}
+
+			// Performance overlay, percentiles over the last few seconds and a bar per phase against a 60Hz frame
+			if (draw_profiler) {
+				float text_x = camera.resolution.x * 0.285f;
+				float text_y = camera.resolution.y * 0.85f;
+				float text_y_offset = 30.f;
+				float column_width = camera.resolution.x * 0.23f;
+				float label_width = camera.resolution.x * 0.09f;
+				float bar_width = camera.resolution.x * 0.12f;
+				float frame_budget_ms = 1000.f / 60.f;
+
+				quad_renderer.draw_2D(camera, { camera.resolution.x * 0.5f, text_y - (text_y_offset * 4.5f) }, { camera.resolution.x * 0.46f, text_y_offset * 11.f }, { 0.f, 0.f, 0.f, 0.7f });
+
+				string frame = "Frame ms p50/95/99: " + friendly_float(profiler.frame_ms.percentile(0.5f), 4) + "/" + friendly_float(profiler.frame_ms.percentile(0.95f), 4) + "/" + friendly_float(profiler.frame_ms.percentile(0.99f), 4);
+				string tick =  "Tick ms  p50/95/99: " + friendly_float(profiler.tick_ms.percentile(0.5f), 4) + "/" + friendly_float(profiler.tick_ms.percentile(0.95f), 4) + "/" + friendly_float(profiler.tick_ms.percentile(0.99f), 4);
+				string draws = "Draws/Tris: " + to_string(profiler.draw_calls) + "/" + to_string(profiler.triangles) + "   GPU ms: " + friendly_float(profiler.gpu_ms, 4);
+				text_renderer.draw("PERFORMANCE",	{ text_x, text_y - (text_y_offset * 0.f) }, false, utils::colour::yellow);
+				text_renderer.draw(frame,			{ text_x, text_y - (text_y_offset * 1.f) }, false, utils::colour::white);
+				text_renderer.draw(tick,			{ text_x, text_y - (text_y_offset * 2.f) }, false, utils::colour::white);
+				text_renderer.draw(draws,			{ text_x, text_y - (text_y_offset * 3.f) }, false, utils::colour::white);
+
+				text_renderer.draw("SIM MS",		{ text_x, text_y - (text_y_offset * 4.f) }, false, utils::colour::yellow);
+				for (int i = 0; i < Metrics::PHASE_COUNT; i++) {
+					float y = text_y - (text_y_offset * (5.f + i));
+					float length = std::min(profiler.phase_ms[i] / frame_budget_ms, 1.f) * bar_width;
+					text_renderer.draw(Profiler::PHASE_NAMES[i], { text_x, y }, false, utils::colour::white);
+					quad_renderer.draw_2D(camera, { text_x + label_width + (length * 0.5f), y + 8.f }, { length, 16.f }, utils::colour::yellow);
+				}
+
+				// CPU submission above GPU execution for each pass
+				text_renderer.draw("RENDER MS CPU/GPU",	{ text_x + column_width, text_y - (text_y_offset * 4.f) }, false, utils::colour::yellow);
+				for (int i = 0; i < Profiler::PASS_COUNT; i++) {
+					float y = text_y - (text_y_offset * (5.f + i));
+					float cpu_length = std::min(profiler.pass_ms[i] / frame_budget_ms, 1.f) * bar_width;
+					float gpu_length = std::min(profiler.gpu_pass_ms[i] / frame_budget_ms, 1.f) * bar_width;
+					text_renderer.draw(Profiler::PASS_NAMES[i], { text_x + column_width, y }, false, utils::colour::white);
+					quad_renderer.draw_2D(camera, { text_x + column_width + label_width + (cpu_length * 0.5f), y + 12.f }, { cpu_length, 8.f }, utils::colour::green);
+					quad_renderer.draw_2D(camera, { text_x + column_width + label_width + (gpu_length * 0.5f), y + 3.f }, { gpu_length, 8.f }, utils::colour::blue);
+				}
+			}
+
+			// All text queued above goes out in a single draw
+			text_renderer.flush();
+			profiler.end_pass(Profiler::PASS_UI);
 		}
 
 		glDisable(GL_BLEND);
+		profiler.end_frame(metrics);
+
+		if (profiler.gpu_sample_ready)
+			stats.observe_gpu(profiler.gpu_pass_sample);
 	}
 }
 
 void Simulation::destroy() {
-	cube_renderer.destroy();
-	line_renderer.destroy();
-	quad_renderer.destroy();
-	text_renderer.destroy();
-	circle_renderer.destroy();
-	model_renderer.destroy();
-	tri_renderer.destroy();
-
-	wheel_texture.destroy();
-	floor_texture.destroy();
+	// Headless and branch simulations never made any GL objects
+	if (has_context) {
+		cube_renderer.destroy();
+		line_renderer.destroy();
+		quad_renderer.destroy();
+		text_renderer.destroy();
+		circle_renderer.destroy();
+		model_renderer.destroy();
+		tri_renderer.destroy();
+		profiler.destroy();
+
+		wheel_texture.destroy();
+		floor_texture.destroy();
+
+		wheel_model.destroy();
+		grid_model.destroy();
+	}
 
-	wheel_model.destroy();
-	grid_model.destroy();
+	if (physics != nullptr) {
+		physics->destroy();
+		delete physics;
+	}
 
-	physics->destroy();
-	delete physics;
+	recorder.destroy();
+	player.destroy();
+	hash_log.destroy();
+	stats.destroy();
+	metrics_server.destroy();
 }
 
 // Should have another version for random selection
@@ -309,13 +1038,13 @@ void Simulation::add_vehicle(bool is_predator) {
 		(is_predator) ? utils::colour::red : utils::colour::blue,
 		is_predator,
 		100.f,
-		key
+		key,
+		0.f
 	};
 
 	transforms_vehicles.insert(pair<int, Transform>(key, t));
 	attributes_vehicles.insert(pair<int, Vehicle_Attributes>(key, av));
 	lights.insert(pair<int, Light>(key, { { 0.f, 30.f, 0.f }, av.colour.XYZ(), 1.f }));
-	transforms_wheels.insert(pair<int, vector<Transform>>(key, { {}, {}, {}, {} }));
 
 	float SENSOR_ANGLE = utils::gen_random(40.f, 120.f);
 	float SENSOR_OFFSET = utils::gen_random(0.f, 40.f);
@@ -343,13 +1072,17 @@ void Simulation::add_vehicle(bool is_predator) {
 	}
 
 	physics->add_vehicle(key, t, is_predator);
+	recorder.spawn(key, is_predator, vehicle_sensors[key]);
+	stats.born(is_predator);
 }
 
 void Simulation::remove_vehicle() {
 	if (!transforms_vehicles.empty()) {
+		recorder.despawn((--transforms_vehicles.end())->first);
+		stats.died((--attributes_vehicles.end())->second.is_predator);
+
 		transforms_vehicles.erase(--transforms_vehicles.end());
 		attributes_vehicles.erase(--attributes_vehicles.end());
-		transforms_wheels.erase(--transforms_wheels.end());
 		vehicle_sensors.erase(--vehicle_sensors.end());
 		lights.erase(--lights.end());
 	
@@ -363,9 +1096,12 @@ void Simulation::remove_vehicle() {
 }
 
 void Simulation::remove_vehicle(int instance_id) {
+	recorder.despawn(instance_id);
+	if (attributes_vehicles.find(instance_id) != attributes_vehicles.end())
+		stats.died(attributes_vehicles[instance_id].is_predator);
+
 	transforms_vehicles.erase(instance_id);
 	attributes_vehicles.erase(instance_id);
-	transforms_wheels.erase(instance_id);
 	vehicle_sensors.erase(instance_id);
 	lights.erase(instance_id);
 	
@@ -437,8 +1173,44 @@ void Simulation::update_simulation_transforms_from_physics() {
 		it->second.rotation.y = physics->get_vehicle_rotation(instance_key) + 90.f;
 		it->second.position = vec3{ physics->get_vehicle_position(instance_key).x, 4.f, physics->get_vehicle_position(instance_key).y };
 
-		for (int i = 0; i < 4; i++) {
-			transforms_wheels[instance_key][i] = attributes_wheels[i].gen_transform_from_vehicle(physics->vehicles[instance_key].body->GetLinearVelocity(), it->second, 8.f);
+		b2Vec2 velocity = physics->vehicles[instance_key].body->GetLinearVelocity();
+		attributes_vehicles[instance_key].speed = magnitude(vec2{ velocity.x, velocity.y });
+	}
+}
+
+void Simulation::cull_vehicles() {
+	visible_vehicles.clear();
+	visible_sensors.clear();
+
+	// Bounds are a sphere around the body and its wheels, taken from the wheel layout so a wider or further out wheel is not culled
+	float wheel_reach = 0.f;
+	for (size_t i = 0; i < attributes_wheels.size(); i++) {
+		const Wheel_Attributes& w = attributes_wheels[i];
+		wheel_reach = max(wheel_reach, w.distance + max(w.size.x, max(w.size.y, w.size.z)));
+	}
+
+	bool sensors_drawn = draw_sensors || draw_sensor_outlines;
+
+	for (map<int, Transform>::iterator it = transforms_vehicles.begin(); it != transforms_vehicles.end(); ++it) {
+		const Transform& t = it->second;
+
+		float radius = max(magnitude(t.size) * 0.5f, wheel_reach);
+		if (camera.sphere_visible(t.position, radius))
+			visible_vehicles.push_back(it->first);
+
+		if (sensors_drawn) {
+			const Vehicle_Sensors& s = vehicle_sensors[it->first];
+			const vec3* points[6] = { &s.la, &s.lb, &s.lc, &s.ra, &s.rb, &s.rc };
+
+			vec3 lower = s.la;
+			vec3 upper = s.la;
+			for (int i = 1; i < 6; i++) {
+				lower = { min(lower.x, points[i]->x), min(lower.y, points[i]->y), min(lower.z, points[i]->z) };
+				upper = { max(upper.x, points[i]->x), max(upper.y, points[i]->y), max(upper.z, points[i]->z) };
+			}
+
+			if (camera.aabb_visible(lower, upper))
+				visible_sensors.push_back(it->first);
 		}
 	}
 }
@@ -0,0 +1,198 @@
+#include "..\include\state_hash.h"
+#include "..\include\mapped_file.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace {
+	const char HASH_LOG_MAGIC[4] = { 'G', 'L', 'V', 'H' };
+	const uint32_t HASH_LOG_VERSION = 1;
+
+	// Tick then hash, packed without padding
+	const size_t HASH_RECORD_SIZE = sizeof(int32_t) + sizeof(uint64_t);
+	const size_t HASH_HEADER_SIZE = sizeof(HASH_LOG_MAGIC) + sizeof(uint32_t);
+
+	const uint64_t PRIME64_1 = 11400714785074694791ULL;
+	const uint64_t PRIME64_2 = 14029467366897019727ULL;
+	const uint64_t PRIME64_3 = 1609587929392839161ULL;
+	const uint64_t PRIME64_4 = 9650029242287828579ULL;
+	const uint64_t PRIME64_5 = 2870177450012600261ULL;
+
+	uint64_t rotl(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	uint64_t read64(const uint8_t* p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	uint32_t read32(const uint8_t* p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	uint64_t xxh_round(uint64_t acc, uint64_t input) {
+		acc += input * PRIME64_2;
+		acc = rotl(acc, 31);
+		return acc * PRIME64_1;
+	}
+
+	uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+		acc ^= xxh_round(0, v);
+		return acc * PRIME64_1 + PRIME64_4;
+	}
+
+	struct Hash_Log_View {
+		Mapped_File file;
+		size_t count;
+
+		bool init(const char* filename) {
+			if (!file.init(filename) || file.size < HASH_HEADER_SIZE || memcmp(file.data, HASH_LOG_MAGIC, 4) != 0) {
+				std::cout << filename << " is not a state hash log" << std::endl;
+				return false;
+			}
+
+			uint32_t version;
+			memcpy(&version, file.data + 4, sizeof(version));
+			if (version != HASH_LOG_VERSION) {
+				std::cout << filename << " is an incompatible state hash log" << std::endl;
+				return false;
+			}
+
+			count = (file.size - HASH_HEADER_SIZE) / HASH_RECORD_SIZE;
+			return true;
+		}
+
+		void record(size_t i, int32_t& tick, uint64_t& hash) const {
+			const char* p = file.data + HASH_HEADER_SIZE + i * HASH_RECORD_SIZE;
+			memcpy(&tick, p, sizeof(tick));
+			memcpy(&hash, p + sizeof(tick), sizeof(hash));
+		}
+	};
+}
+
+uint64_t xxhash64(const void* data, size_t size, uint64_t seed) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		const uint8_t* limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = xxh_merge(h, v1);
+		h = xxh_merge(h, v2);
+		h = xxh_merge(h, v3);
+		h = xxh_merge(h, v4);
+	}
+	else {
+		h = seed + PRIME64_5;
+	}
+
+	h += static_cast<uint64_t>(size);
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh_round(0, read64(p));
+		h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+		h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool State_Hash_Log::init(const char* filename) {
+	destroy();
+
+	ofs.open(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to open state hash log " << filename << std::endl;
+		return false;
+	}
+
+	ofs.write(HASH_LOG_MAGIC, sizeof(HASH_LOG_MAGIC));
+	ofs.write(reinterpret_cast<const char*>(&HASH_LOG_VERSION), sizeof(HASH_LOG_VERSION));
+	return true;
+}
+
+void State_Hash_Log::destroy() {
+	if (ofs.is_open())
+		ofs.close();
+}
+
+bool State_Hash_Log::is_open() const {
+	return ofs.is_open();
+}
+
+void State_Hash_Log::write(int tick, uint64_t hash) {
+	if (!is_open())
+		return;
+
+	int32_t t = static_cast<int32_t>(tick);
+	ofs.write(reinterpret_cast<const char*>(&t), sizeof(t));
+	ofs.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+}
+
+int State_Hash_Log::compare(const char* filename_a, const char* filename_b) {
+	Hash_Log_View a, b;
+	if (!a.init(filename_a) || !b.init(filename_b))
+		return 2;
+
+	// Ticks only ever increase, so the logs are walked together and records only one of them has are skipped
+	size_t i = 0, j = 0, common = 0;
+	while (i < a.count && j < b.count) {
+		int32_t tick_a, tick_b;
+		uint64_t hash_a, hash_b;
+		a.record(i, tick_a, hash_a);
+		b.record(j, tick_b, hash_b);
+
+		if (tick_a < tick_b) {
+			i++;
+		}
+		else if (tick_b < tick_a) {
+			j++;
+		}
+		else {
+			if (hash_a != hash_b) {
+				std::cout << "Diverged at tick " << tick_a << " after " << common << " matching ticks" << std::endl;
+				return 1;
+			}
+
+			common++;
+			i++;
+			j++;
+		}
+	}
+
+	std::cout << "No divergence over " << common << " common ticks" << std::endl;
+	return 0;
+}
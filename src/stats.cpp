@@ -0,0 +1,186 @@
+#include "..\include\stats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <iostream>
+
+Stats::Stats() : predators(0), prey(0), births(0), deaths(0), catches(0), interval(30), stopping(false) {
+	reset_interval();
+}
+
+bool Stats::init(const char* filename, int interval) {
+	destroy();
+
+	ofs.open(filename, std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to open stats file " << filename << std::endl;
+		return false;
+	}
+
+	ofs << "tick,generation,predators,prey,births,deaths,catches,mean_energy,min_energy,max_energy,mean_speed,"
+		"step_ms,collide_ms,solve_ms,solve_toi_ms,broadphase_ms,bodies,awake_bodies,contacts,touching_contacts,joints,begin_contacts";
+	for (int i = 0; i < Profiler::PASS_COUNT; i++) {
+		std::string name = Profiler::PASS_NAMES[i];
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+		ofs << ",gpu_" << name << "_ms";
+	}
+	ofs << std::endl;
+
+	this->interval = interval;
+	stopping = false;
+	reset_interval();
+
+	writer = std::thread(&Stats::write_rows, this);
+	return true;
+}
+
+void Stats::destroy() {
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		queue_ready.notify_one();
+		writer.join();
+	}
+
+	if (ofs.is_open())
+		ofs.close();
+}
+
+bool Stats::is_open() const {
+	return ofs.is_open();
+}
+
+void Stats::born(bool is_predator) {
+	is_predator ? predators++ : prey++;
+	births++;
+	current.births++;
+}
+
+void Stats::died(bool is_predator) {
+	is_predator ? predators-- : prey--;
+	deaths++;
+	current.deaths++;
+}
+
+void Stats::caught() {
+	catches++;
+	current.catches++;
+}
+
+void Stats::recount(const map<int, Vehicle_Attributes>& attributes) {
+	predators = prey = 0;
+	for (map<int, Vehicle_Attributes>::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+		it->second.is_predator ? predators++ : prey++;
+}
+
+void Stats::observe(float energy, float speed) {
+	observations++;
+	energy_sum += energy;
+	speed_sum += speed;
+	current.min_energy = (energy < current.min_energy) ? energy : current.min_energy;
+	current.max_energy = (energy > current.max_energy) ? energy : current.max_energy;
+}
+
+void Stats::observe_physics(const Physics_Profile& profile) {
+	physics_steps++;
+	physics_sum.step += profile.step;
+	physics_sum.collide += profile.collide;
+	physics_sum.solve += profile.solve;
+	physics_sum.solve_toi += profile.solve_toi;
+	physics_sum.broadphase += profile.broadphase;
+	physics_sum.begin_contacts += profile.begin_contacts;
+
+	current.physics.bodies = profile.bodies;
+	current.physics.awake_bodies = profile.awake_bodies;
+	current.physics.contacts = profile.contacts;
+	current.physics.touching_contacts = profile.touching_contacts;
+	current.physics.joints = profile.joints;
+}
+
+void Stats::observe_gpu(const float pass_ms[Profiler::PASS_COUNT]) {
+	gpu_frames++;
+	for (int i = 0; i < Profiler::PASS_COUNT; i++)
+		gpu_sum[i] += pass_ms[i];
+}
+
+void Stats::end_tick(int tick, int generation) {
+	if (tick % interval != 0)
+		return;
+
+	if (is_open()) {
+		current.tick = tick;
+		current.generation = generation;
+		current.predators = predators;
+		current.prey = prey;
+		current.mean_energy = (observations > 0) ? static_cast<float>(energy_sum / observations) : 0.f;
+		current.mean_speed = (observations > 0) ? static_cast<float>(speed_sum / observations) : 0.f;
+		if (observations == 0)
+			current.min_energy = current.max_energy = 0.f;
+
+		float steps = (physics_steps > 0) ? static_cast<float>(physics_steps) : 1.f;
+		current.physics.step = physics_sum.step / steps;
+		current.physics.collide = physics_sum.collide / steps;
+		current.physics.solve = physics_sum.solve / steps;
+		current.physics.solve_toi = physics_sum.solve_toi / steps;
+		current.physics.broadphase = physics_sum.broadphase / steps;
+		current.physics.begin_contacts = physics_sum.begin_contacts;
+
+		for (int i = 0; i < Profiler::PASS_COUNT; i++)
+			current.gpu_ms[i] = (gpu_frames > 0) ? static_cast<float>(gpu_sum[i] / gpu_frames) : 0.f;
+
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			queue.push_back(current);
+		}
+		queue_ready.notify_one();
+	}
+
+	reset_interval();
+}
+
+void Stats::reset_interval() {
+	current = Stats_Sample();
+	current.min_energy = FLT_MAX;
+	current.max_energy = -FLT_MAX;
+	observations = 0;
+	energy_sum = 0.0;
+	speed_sum = 0.0;
+	physics_steps = 0;
+	physics_sum = Physics_Profile();
+	gpu_frames = 0;
+	for (int i = 0; i < Profiler::PASS_COUNT; i++)
+		gpu_sum[i] = 0.0;
+}
+
+void Stats::write_rows() {
+	std::vector<Stats_Sample> rows;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+			// Taken as a batch so the lock is only held for the swap
+			rows.swap(queue);
+			if (rows.empty() && stopping)
+				return;
+		}
+
+		for (size_t i = 0; i < rows.size(); i++) {
+			const Stats_Sample& s = rows[i];
+			ofs << s.tick << ',' << s.generation << ',' << s.predators << ',' << s.prey << ',' << s.births << ',' << s.deaths << ',' << s.catches << ','
+				<< s.mean_energy << ',' << s.min_energy << ',' << s.max_energy << ',' << s.mean_speed << ','
+				<< s.physics.step << ',' << s.physics.collide << ',' << s.physics.solve << ',' << s.physics.solve_toi << ',' << s.physics.broadphase << ','
+				<< s.physics.bodies << ',' << s.physics.awake_bodies << ',' << s.physics.contacts << ',' << s.physics.touching_contacts << ','
+				<< s.physics.joints << ',' << s.physics.begin_contacts;
+			for (int p = 0; p < Profiler::PASS_COUNT; p++)
+				ofs << ',' << s.gpu_ms[p];
+			ofs << '\n';
+		}
+		ofs.flush();
+		rows.clear();
+	}
+}
@@ -1,30 +1,191 @@
 #include "..\include\texture.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
 #include <SOIL.h>
 
-void Texture::init(const char* filename) {
+namespace {
+	const char TEXTURE_CACHE_MAGIC[4] = { 'G', 'L', 'V', 'T' };
+	const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+	struct Texture_Cache_Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t source_size;
+		int64_t source_time;
+		int32_t width;
+		int32_t height;
+		int32_t levels;
+		int32_t padding;
+	};
+
+	size_t level_size(int width, int height, int level) {
+		return static_cast<size_t>(std::max(1, width >> level)) * std::max(1, height >> level) * 3;
+	}
+
+	size_t chain_size(int width, int height, int levels) {
+		size_t size = 0;
+		for (int i = 0; i < levels; i++)
+			size += level_size(width, height, i);
+		return size;
+	}
+
+	int level_count(int width, int height) {
+		int levels = 1;
+		while ((width >> levels) > 0 || (height >> levels) > 0)
+			levels++;
+		return levels;
+	}
+
+	// 2x2 box filter, the last row or column is reused when a dimension is odd
+	void downsample(const unsigned char* src, int src_width, int src_height, unsigned char* dst) {
+		int dst_width = std::max(1, src_width / 2);
+		int dst_height = std::max(1, src_height / 2);
+
+		for (int y = 0; y < dst_height; y++) {
+			int y0 = std::min(y * 2, src_height - 1);
+			int y1 = std::min(y * 2 + 1, src_height - 1);
+
+			for (int x = 0; x < dst_width; x++) {
+				int x0 = std::min(x * 2, src_width - 1);
+				int x1 = std::min(x * 2 + 1, src_width - 1);
+
+				for (int c = 0; c < 3; c++) {
+					int sum = src[(y0 * src_width + x0) * 3 + c] + src[(y0 * src_width + x1) * 3 + c] +
+						src[(y1 * src_width + x0) * 3 + c] + src[(y1 * src_width + x1) * 3 + c];
+					dst[(y * dst_width + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+Texture_Data::Texture_Data() {
+	width = 0;
+	height = 0;
+	levels = 0;
+	data = nullptr;
+}
+
+bool Texture::decode(const char* filename, Texture_Data& out) {
+	std::string cache_name = std::string(filename) + ".cache";
+
+	// The asset pack only returns a cache whose source is unchanged since the pack was built
+	const char* cache_data = nullptr;
+	size_t cache_size = 0;
+	bool packed = asset_pack.find(cache_name, cache_data, cache_size);
+
+	// A packed texture never looks at the image on disk, one that fails its checks is decoded again but not cached
+	Texture_Cache_Header header = {};
+	bool stamped = !packed && utils::file_stamp(filename, header.source_size, header.source_time);
+
+	uint64_t stamp_size;
+	int64_t stamp_time;
+	if (!packed && stamped && utils::file_stamp(cache_name.c_str(), stamp_size, stamp_time) && out.cache.init(cache_name.c_str())) {
+		cache_data = out.cache.data;
+		cache_size = out.cache.size;
+	}
+
+	if (cache_data != nullptr) {
+		const Texture_Cache_Header* cached = reinterpret_cast<const Texture_Cache_Header*>(cache_data);
+
+		if (cache_size >= sizeof(Texture_Cache_Header) &&
+			memcmp(cached->magic, TEXTURE_CACHE_MAGIC, 4) == 0 && cached->version == TEXTURE_CACHE_VERSION &&
+			(packed || (cached->source_size == header.source_size && cached->source_time == header.source_time)) &&
+			cache_size >= sizeof(Texture_Cache_Header) + chain_size(cached->width, cached->height, cached->levels)) {
+			out.width = cached->width;
+			out.height = cached->height;
+			out.levels = cached->levels;
+			out.data = reinterpret_cast<const unsigned char*>(cache_data) + sizeof(Texture_Cache_Header);
+			return true;
+		}
+
+		out.cache.destroy();
+	}
+
+	int width, height;
+	unsigned char* image = SOIL_load_image(filename, &width, &height, 0, SOIL_LOAD_RGB);
+	if (image == nullptr) {
+		std::cout << "Failed to load " << filename << std::endl;
+		return false;
+	}
+
+	out.width = width;
+	out.height = height;
+	out.levels = level_count(width, height);
+	out.pixels.resize(chain_size(width, height, out.levels));
+
+	memcpy(&out.pixels[0], image, level_size(width, height, 0));
+	SOIL_free_image_data(image);
+
+	size_t offset = 0;
+	for (int i = 1; i < out.levels; i++) {
+		size_t next = offset + level_size(width, height, i - 1);
+		downsample(&out.pixels[offset], std::max(1, width >> (i - 1)), std::max(1, height >> (i - 1)), &out.pixels[next]);
+		offset = next;
+	}
+
+	out.data = &out.pixels[0];
+
+	if (stamped) {
+		memcpy(header.magic, TEXTURE_CACHE_MAGIC, 4);
+		header.version = TEXTURE_CACHE_VERSION;
+		header.width = width;
+		header.height = height;
+		header.levels = out.levels;
+
+		std::ofstream ofs(utils::temp_filename(cache_name.c_str()).c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		ofs.write(reinterpret_cast<const char*>(out.data), out.pixels.size());
+		utils::commit_file(ofs, cache_name.c_str());
+	}
+
+	return true;
+}
+
+void Texture::upload(const Texture_Data& data) {
 	glGenTextures(1, &tex);
-	glActiveTexture(0);
+	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, tex);
 
-	utils::dimensions d = utils::png_dimensions(filename);
+	// Levels are tightly packed RGB, so rows are not 4-byte aligned once they get small
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-	unsigned char* image = SOIL_load_image(filename, &d.width, &d.height, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, d.width, d.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	SOIL_free_image_data(image);
+	const unsigned char* level = data.data;
+	for (int i = 0; i < data.levels; i++) {
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, std::max(1, data.width >> i), std::max(1, data.height >> i), 0, GL_RGB, GL_UNSIGNED_BYTE, level);
+		level += level_size(data.width, data.height, i);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(0, data.levels - 1));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
+void Texture::init(const char* filename) {
+	Texture_Data data;
+	if (decode(filename, data))
+		upload(data);
+}
+
 void Texture::use() {
+	if (tex == 0)
+		return;
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, tex);
 }
 
 
 void Texture::destroy() {
-	glDeleteTextures(1, &tex);
-}
\ No newline at end of file
+	if (tex != 0)
+		glDeleteTextures(1, &tex);
+	tex = 0;
+}
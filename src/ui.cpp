@@ -5,9 +5,9 @@ UI::UI() { }
 UI::UI(const Camera& camera) : index_active_button(-1), index_pressed_button(-1) {
 	attributes_ui = std::vector<Button_Attributes>();
 
-	const static int NUM_BUTTONS = 9;
+	const static int NUM_BUTTONS = 10;
 
-	std::string button_labels[NUM_BUTTONS] = { "ADD", "REMOVE", "FOLLOW", "PLAY", "PAUSE", "NEW", "EXIT", "SENSORS", "OUTLINES" };
+	std::string button_labels[NUM_BUTTONS] = { "ADD", "REMOVE", "FOLLOW", "PLAY", "PAUSE", "NEW", "EXIT", "SENSORS", "OUTLINES", "PERF" };
 	for (int i = 0; i < NUM_BUTTONS; i++) {
 		float width_by_buttons = camera.resolution.x / NUM_BUTTONS;
 		float px = (i * width_by_buttons) + (width_by_buttons * 0.5f);
@@ -15,7 +15,7 @@ UI::UI(const Camera& camera) : index_active_button(-1), index_pressed_button(-1)
 		float height_by_buttons = camera.resolution.y / (NUM_BUTTONS * 2.f);
 		float py = (i * height_by_buttons) + (height_by_buttons * 0.5f);
 
-		float button_width = camera.resolution.x / 10.f;
+		float button_width = camera.resolution.x / 11.f;
 		float button_height = camera.resolution.y / 20.f;
 		attributes_ui.push_back({ { px, button_height / 2.f }, { button_width, button_height }, utils::colour::black, button_labels[i] });
 	}
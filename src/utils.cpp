@@ -1,6 +1,62 @@
 #include "..\include\utils.h"
 
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace utils {
+	std::string temp_filename(const char* filename) {
+#ifdef _WIN32
+		unsigned long process = GetCurrentProcessId();
+#else
+		unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+		size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+		return std::string(filename) + "." + std::to_string(process) + "-" + std::to_string(thread) + ".tmp";
+	}
+
+	bool commit_file(std::ofstream& ofs, const char* filename) {
+		std::string temp = temp_filename(filename);
+
+		// Closing flushes, so a short write shows up here too
+		ofs.close();
+		if (!ofs) {
+			std::remove(temp.c_str());
+			std::cout << "Failed to write " << filename << std::endl;
+			return false;
+		}
+
+		// Both replace an existing file atomically, so it is never removed first
+#ifdef _WIN32
+		bool replaced = MoveFileExA(temp.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		bool replaced = std::rename(temp.c_str(), filename) == 0;
+#endif
+		if (!replaced) {
+			std::remove(temp.c_str());
+			std::cout << "Failed to replace " << filename << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	std::mt19937& random_engine() {
+		thread_local std::mt19937 mt(std::random_device{}());
+		return mt;
+	}
+
+	void seed_random(uint32_t seed) {
+		random_engine().seed(seed);
+	}
+
 	namespace colour {
 		vec4 black		= { 0.f, 0.f, 0.f, 1.f };
 		vec4 white		= { 1.f, 1.f, 1.f, 1.f };
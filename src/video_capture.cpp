@@ -0,0 +1,230 @@
+#include "..\include\video_capture.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+	bool ends_with(const std::string& s, const std::string& suffix) {
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	// Full range BT.601 in 16.16 fixed point, what C420jpeg means
+	uint8_t luma(int r, int g, int b) {
+		return static_cast<uint8_t>((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+	}
+
+	// Saturated blue or red rounds up to 256, one past what a byte holds
+	uint8_t clamp_byte(int v) {
+		return static_cast<uint8_t>(v > 255 ? 255 : v);
+	}
+
+	uint8_t chroma_u(int r, int g, int b) {
+		return clamp_byte((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16);
+	}
+
+	uint8_t chroma_v(int r, int g, int b) {
+		return clamp_byte((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32768) >> 16);
+	}
+}
+
+Video_Capture::Video_Capture() : width(0), height(0), is_y4m(false), frames_read(0), frames_queued(0), stopping(false)
+{
+	for (int i = 0; i < PIXEL_BUFFERS; i++)
+		pixel_buffers[i] = 0;
+}
+
+bool Video_Capture::init(const char* filename, int width, int height, int fps) {
+	destroy();
+
+	is_y4m = ends_with(filename, ".y4m");
+
+	// 4:2:0 chroma covers 2x2 blocks
+	this->width = is_y4m ? width & ~1 : width;
+	this->height = is_y4m ? height & ~1 : height;
+
+	ofs.open(filename, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+	if (!ofs) {
+		std::cout << "Failed to open video file " << filename << std::endl;
+		return false;
+	}
+
+	if (is_y4m)
+		ofs << "YUV4MPEG2 W" << this->width << " H" << this->height << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+
+	if (!target.init(this->width, this->height)) {
+		destroy();
+		return false;
+	}
+
+	glGenBuffers(PIXEL_BUFFERS, pixel_buffers);
+	for (int i = 0; i < PIXEL_BUFFERS; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, this->width * this->height * 4, nullptr, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	frames_read = 0;
+	frames_queued = 0;
+	stopping = false;
+	writer = std::thread(&Video_Capture::write_frames, this);
+	return true;
+}
+
+void Video_Capture::destroy() {
+	// Frames still in flight in the ring are waited on here, nothing is left to stall
+	if (writer.joinable()) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		while (frames_read < frames_queued)
+			read_back(frames_read++ % PIXEL_BUFFERS);
+
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		queue_changed.notify_all();
+		writer.join();
+	}
+
+	target.destroy();
+	if (pixel_buffers[0] != 0) {
+		glDeleteBuffers(PIXEL_BUFFERS, pixel_buffers);
+		for (int i = 0; i < PIXEL_BUFFERS; i++)
+			pixel_buffers[i] = 0;
+	}
+
+	if (ofs.is_open())
+		ofs.close();
+}
+
+bool Video_Capture::is_open() const {
+	return ofs.is_open();
+}
+
+void Video_Capture::begin_frame() {
+	target.bind();
+}
+
+void Video_Capture::end_frame() {
+	// Queues the copy into the next buffer of the ring, with a pack buffer bound glReadPixels returns without waiting
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[frames_queued % PIXEL_BUFFERS]);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	frames_queued++;
+
+	if (frames_queued - frames_read >= PIXEL_BUFFERS)
+		read_back(frames_read++ % PIXEL_BUFFERS);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Video_Capture::read_back(int index) {
+	std::vector<uint8_t> frame;
+	{
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		queue_changed.wait(lock, [this]() { return queue.size() < MAX_QUEUED_FRAMES; });
+		if (!spare.empty()) {
+			frame.swap(spare.back());
+			spare.pop_back();
+		}
+	}
+
+	size_t size = static_cast<size_t>(width) * height * 4;
+	frame.resize(size);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[index]);
+	void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (pixels != nullptr) {
+		memcpy(frame.data(), pixels, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queue.push_back(std::vector<uint8_t>());
+		queue.back().swap(frame);
+	}
+	queue_changed.notify_all();
+}
+
+void Video_Capture::write_frames() {
+	std::vector<std::vector<uint8_t>> frames;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+
+			// Written buffers go back for the next read_back to reuse
+			for (size_t i = 0; i < frames.size(); i++) {
+				spare.push_back(std::vector<uint8_t>());
+				spare.back().swap(frames[i]);
+			}
+			frames.clear();
+
+			queue_changed.wait(lock, [this]() { return stopping || !queue.empty(); });
+			frames.swap(queue);
+			if (frames.empty() && stopping)
+				return;
+		}
+		queue_changed.notify_all();
+
+		for (size_t i = 0; i < frames.size(); i++) {
+			if (is_y4m)
+				write_y4m(frames[i]);
+			else
+				write_rgb(frames[i]);
+		}
+		ofs.flush();
+	}
+}
+
+void Video_Capture::write_y4m(const std::vector<uint8_t>& rgba) {
+	int chroma_width = width / 2;
+	int chroma_height = height / 2;
+	converted.resize(width * height + chroma_width * chroma_height * 2);
+
+	uint8_t* y_plane = converted.data();
+	uint8_t* u_plane = y_plane + width * height;
+	uint8_t* v_plane = u_plane + chroma_width * chroma_height;
+
+	// GL rows run bottom to top, video rows top to bottom
+	for (int y = 0; y < height; y++) {
+		const uint8_t* row = rgba.data() + static_cast<size_t>(height - 1 - y) * width * 4;
+		for (int x = 0; x < width; x++)
+			y_plane[y * width + x] = luma(row[x * 4], row[x * 4 + 1], row[x * 4 + 2]);
+	}
+
+	for (int y = 0; y < chroma_height; y++) {
+		const uint8_t* row_a = rgba.data() + static_cast<size_t>(height - 1 - y * 2) * width * 4;
+		const uint8_t* row_b = row_a - width * 4;
+		for (int x = 0; x < chroma_width; x++) {
+			const uint8_t* a = row_a + x * 8;
+			const uint8_t* b = row_b + x * 8;
+			int r = (a[0] + a[4] + b[0] + b[4] + 2) >> 2;
+			int g = (a[1] + a[5] + b[1] + b[5] + 2) >> 2;
+			int bl = (a[2] + a[6] + b[2] + b[6] + 2) >> 2;
+			u_plane[y * chroma_width + x] = chroma_u(r, g, bl);
+			v_plane[y * chroma_width + x] = chroma_v(r, g, bl);
+		}
+	}
+
+	ofs << "FRAME\n";
+	ofs.write(reinterpret_cast<const char*>(converted.data()), converted.size());
+}
+
+void Video_Capture::write_rgb(const std::vector<uint8_t>& rgba) {
+	converted.resize(width * height * 3);
+
+	for (int y = 0; y < height; y++) {
+		const uint8_t* row = rgba.data() + static_cast<size_t>(height - 1 - y) * width * 4;
+		uint8_t* out = converted.data() + static_cast<size_t>(y) * width * 3;
+		for (int x = 0; x < width; x++) {
+			out[x * 3] = row[x * 4];
+			out[x * 3 + 1] = row[x * 4 + 1];
+			out[x * 3 + 2] = row[x * 4 + 2];
+		}
+	}
+
+	ofs.write(reinterpret_cast<const char*>(converted.data()), converted.size());
+}